@@ -0,0 +1,177 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+
+// A/B harness: runs the original strategy (OgAutoTrader, og-trader-cpy.cc)
+// and a StrategyTrader composition side by side on the market data recorded in
+// journals, each against its own simulated exchange, and reports per tick how
+// they differ.
+//
+//   abtest [--strategy=<type>] <journal>...
+//
+// The type is one of host.cc's strategy types, autotrader (AutoTrader) by default.
+//
+// Only the recorded order books and trade ticks are replayed; each strategy's
+// fills come from a simple simulator (FillSimulator below), so both are judged
+// on the same market with the same rules. Journals run in parallel, one thread
+// each, and every journal gets <journal>.ab.csv with one row per ETF book:
+// orders sent that tick, ETF and future positions, messages used so far and
+// marked PnL for both strategies.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+
+#include <ready_trader_go/types.h>
+
+#include "fillsimulator.h"
+#include "journal.h"
+#include "og-trader-cpy.h"
+#include "replaydriver.h"
+#include "sendsink.h"
+
+using namespace ReadyTraderGo;
+
+struct AbResult
+{
+    unsigned long ticks = 0;
+    unsigned long divergentTicks = 0;
+    long ogPnl = 0;
+    long autoPnl = 0;
+};
+
+// Runs one journal through both strategies in lockstep, one market record at a time
+template<typename Trader>
+static AbResult runJournal(const std::string& fileName)
+{
+    AbResult result;
+    JournalReader journal(fileName);
+    if (!journal.IsOpen()) {
+        std::cerr << "could not read journal " << fileName << std::endl;
+        return result;
+    }
+
+    boost::asio::io_context context;
+
+    OgAutoTrader* og = nullptr;
+    FillSimulator ogExchange([&og](const JournalRecord& record) { feedRecord(*og, record); });
+    OgAutoTrader ogTrader(context, &ogExchange);
+    og = &ogTrader;
+
+    ReplayDriver<Trader>* driver = nullptr;
+    FillSimulator autoExchange([&driver](const JournalRecord& record) { driver->Feed(record); });
+    ReplayDriver<Trader> autoDriver(context, journal.Header(), &autoExchange);
+    driver = &autoDriver;
+
+    std::ofstream csv(fileName + ".ab.csv");
+    csv << "tick,og_orders,auto_orders,og_etf,auto_etf,og_fut,auto_fut,og_messages,auto_messages,og_pnl,auto_pnl\n";
+
+    unsigned long ogOrders = 0, autoOrders = 0;
+    for (std::uint64_t i = 0; i < journal.Count(); i++) {
+        const JournalRecord& record = journal[i];
+        if (record.type != JournalType::ORDER_BOOK && record.type != JournalType::TRADE_TICKS) continue;
+
+        ogExchange.OnMarket(record);
+        ogExchange.Settle();
+        feedRecord(ogTrader, record);
+        ogExchange.Settle();
+
+        autoExchange.OnMarket(record);
+        autoExchange.Settle();
+        autoDriver.FireDueTimer(record.timestamp);
+        autoDriver.Feed(record);
+        autoExchange.Settle();
+
+        if (record.type != JournalType::ORDER_BOOK || static_cast<Instrument>(record.instrument) != Instrument::ETF) {
+            continue;
+        }
+
+        unsigned long ogTick = ogExchange.OrdersSent() - ogOrders, autoTick = autoExchange.OrdersSent() - autoOrders;
+        ogOrders = ogExchange.OrdersSent();
+        autoOrders = autoExchange.OrdersSent();
+        result.ticks++;
+        if (ogTick != autoTick || ogExchange.EtfPosition() != autoExchange.EtfPosition()) result.divergentTicks++;
+
+        csv << record.book.sequenceNumber << ',' << ogTick << ',' << autoTick << ','
+            << ogExchange.EtfPosition() << ',' << autoExchange.EtfPosition() << ','
+            << ogExchange.FutPosition() << ',' << autoExchange.FutPosition() << ','
+            << ogExchange.Messages() << ',' << autoExchange.Messages() << ','
+            << ogExchange.Pnl() << ',' << autoExchange.Pnl() << '\n';
+    }
+
+    result.ogPnl = ogExchange.Pnl();
+    result.autoPnl = autoExchange.Pnl();
+    return result;
+}
+
+// The second arm for each strategy type, by host.cc's names for them
+static const std::map<std::string, AbResult (*)(const std::string&)>& strategyArms()
+{
+    static const std::map<std::string, AbResult (*)(const std::string&)> arms = {
+        {"autotrader", runJournal<AutoTrader>},
+        {"autotrader-half-room", runJournal<StrategyTrader<HalfRoomStrategy>>},
+    };
+    return arms;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string strategy = "autotrader";
+    int arg = 1;
+    if (arg < argc && std::strncmp(argv[arg], "--strategy=", 11) == 0) {
+        strategy = argv[arg++] + 11;
+    }
+
+    auto arm = strategyArms().find(strategy);
+    if (arg >= argc || arm == strategyArms().end()) {
+        std::cerr << "usage: abtest [--strategy=<type>] <journal>...\n       types:";
+        for (const auto& known : strategyArms()) std::cerr << " " << known.first;
+        std::cerr << std::endl;
+        return 2;
+    }
+
+    std::vector<std::string> fileNames(argv + arg, argv + argc);
+    std::vector<AbResult> results(fileNames.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < fileNames.size(); i++) {
+        threads.emplace_back([&, i] { results[i] = arm->second(fileNames[i]); });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    long ogTotal = 0, autoTotal = 0;
+    for (std::size_t i = 0; i < fileNames.size(); i++) {
+        const AbResult& result = results[i];
+        std::cout << fileNames[i] << ": " << result.ticks << " ticks, " << result.divergentTicks
+                  << " divergent, og pnl " << result.ogPnl << ", " << strategy << " pnl " << result.autoPnl << "\n";
+        ogTotal += result.ogPnl;
+        autoTotal += result.autoPnl;
+    }
+    std::cout << "total: og pnl " << ogTotal << ", " << strategy << " pnl " << autoTotal << std::endl;
+    return 0;
+}
@@ -0,0 +1,181 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_ANALYTICS_H
+#define CPPREADY_TRADER_GO_ANALYTICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include <ready_trader_go/types.h>
+
+#include "markouts.h"
+#include "seqlock.h"
+#include "spscring.h"
+
+constexpr double FLOW_WEIGHT = 0.3;
+constexpr double INTENSITY_WEIGHT = 0.2;
+constexpr std::size_t ANALYTICS_RING_SIZE = 4096;
+
+// Signal results the trading path reads back
+struct AnalyticsSignals
+{
+    double recentBuyMarkout = 0.0;
+    double recentSellMarkout = 0.0;
+    double tradeFlow = 0.0;
+    double tradeIntensity = 0.0;
+};
+
+// Market and fill events reduced to what the signals need:
+//   FUTURE_MID - price is the futures mid
+//   ETF_TRADES - volume is the aggressively bought volume, extra the sold volume
+//   FILL       - one of our ETF fills, extra is its distance in ticks from the futures mid
+struct AnalyticsEvent
+{
+    enum class Type : std::uint8_t
+    {
+        FUTURE_MID,
+        ETF_TRADES,
+        FILL
+    };
+
+    Type type = Type::FUTURE_MID;
+    ReadyTraderGo::Side side = ReadyTraderGo::Side::BUY;
+    unsigned long price = 0;
+    unsigned long volume = 0;
+    unsigned long extra = 0;
+};
+
+// The signal maths, with no idea which thread it runs on
+class AnalyticsEngine
+{
+public:
+    void Apply(const AnalyticsEvent& event)
+    {
+        switch (event.type) {
+        case AnalyticsEvent::Type::FUTURE_MID:
+            mMarkouts.OnTick(event.price);
+            break;
+        case AnalyticsEvent::Type::ETF_TRADES:
+            // Trading at the asks is aggressive buying, at the bids aggressive selling.
+            // Flow is a weighted imbalance between -1 (all selling) and 1 (all buying).
+            if (event.volume + event.extra) {
+                double imbalance = ((double)event.volume - (double)event.extra) / (double)(event.volume + event.extra);
+                mTradeFlow += (imbalance - mTradeFlow) * FLOW_WEIGHT;
+            }
+            mTradeIntensity += ((double)(event.volume + event.extra) - mTradeIntensity) * INTENSITY_WEIGHT;
+            break;
+        case AnalyticsEvent::Type::FILL:
+            mMarkouts.AddFill(event.side, event.price, event.volume, event.extra);
+            break;
+        }
+    }
+
+    AnalyticsSignals Signals() const
+    {
+        return {mMarkouts.Recent(ReadyTraderGo::Side::BUY), mMarkouts.Recent(ReadyTraderGo::Side::SELL),
+                mTradeFlow, mTradeIntensity};
+    }
+
+    const MarkoutTracker& Markouts() const { return mMarkouts; }
+
+private:
+    MarkoutTracker mMarkouts;
+    double mTradeFlow = 0.0;
+    double mTradeIntensity = 0.0;
+};
+
+// Runs the analytics engine either inline on the caller's thread or on its own
+// thread. Threaded, Post only pushes onto a lock-free SPSC ring (dropping the
+// event if the ring is full rather than blocking) and Signals reads the last
+// published results through a seqlock, so the trading thread never waits on
+// the signal maths.
+class Analytics
+{
+public:
+    explicit Analytics(bool threaded) : mThreaded(threaded)
+    {
+        if (mThreaded) {
+            mRunning = true;
+            mThread = std::thread([this] { run(); });
+        }
+    }
+
+    ~Analytics() { Stop(); }
+
+    Analytics(const Analytics&) = delete;
+    Analytics& operator=(const Analytics&) = delete;
+
+    void Post(const AnalyticsEvent& event)
+    {
+        if (!mThreaded) {
+            mEngine.Apply(event);
+            mInlineSignals = mEngine.Signals();
+        }
+        else if (!mEvents.TryPush(event)) {
+            mDropped++;
+        }
+    }
+
+    AnalyticsSignals Signals() const
+    {
+        return mThreaded ? mSignals.Load() : mInlineSignals;
+    }
+
+    // Drains what is already queued and joins the thread, after which Engine()
+    // is safe to read from the trading thread
+    void Stop()
+    {
+        if (mThread.joinable()) {
+            mRunning = false;
+            mThread.join();
+        }
+    }
+
+    const AnalyticsEngine& Engine() const { return mEngine; }
+    unsigned long Dropped() const { return mDropped; }
+
+private:
+    void run()
+    {
+        AnalyticsEvent event;
+        for (;;) {
+            // Check before draining so that nothing posted before Stop is lost
+            bool running = mRunning.load(std::memory_order_acquire);
+            bool applied = false;
+            while (mEvents.TryPop(event)) {
+                mEngine.Apply(event);
+                applied = true;
+            }
+            if (applied) mSignals.Store(mEngine.Signals());
+            else if (!running) return;
+            else std::this_thread::yield();
+        }
+    }
+
+    AnalyticsEngine mEngine;
+    bool mThreaded;
+    unsigned long mDropped = 0;
+    AnalyticsSignals mInlineSignals;
+    SpscRing<AnalyticsEvent, ANALYTICS_RING_SIZE> mEvents;
+    Seqlock<AnalyticsSignals> mSignals;
+    std::atomic<bool> mRunning{false};
+    std::thread mThread;
+};
+
+#endif //CPPREADY_TRADER_GO_ANALYTICS_H
@@ -18,9 +18,18 @@
 
 // Maybe hedge when we hit max either side to stop prolonged fall causing bad directional exposure when there iss lots of momentum
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <ready_trader_go/logging.h>
 
@@ -31,92 +40,222 @@ using namespace ReadyTraderGo;
 
 RTG_INLINE_GLOBAL_LOGGER_WITH_CHANNEL(LG_AT, "AUTO")
 
-constexpr unsigned long POSITION_LIMIT = 100;
-constexpr int TICK_SIZE_IN_CENTS = 100;
-constexpr int FUT_CLEARANCE = 0 * TICK_SIZE_IN_CENTS;
-constexpr int MIN_BID_NEARST_TICK = (MINIMUM_BID + TICK_SIZE_IN_CENTS) / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
-constexpr int MAX_ASK_NEAREST_TICK = MAXIMUM_ASK / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
-constexpr int TICKS_PER_SECOND = 4;
-constexpr int MAX_UNHEDGED_SEC = 55;
-constexpr int MAX_UNHEDGED_TICKS = MAX_UNHEDGED_SEC * TICKS_PER_SECOND;
-constexpr int HEDGE_LIMIT = 10;
+constexpr double ETF_CLAMP = 0.002;
+constexpr double TAKER_FEE = 0.0002;
+constexpr std::chrono::seconds UNHEDGED_TIME_LIMIT{60};
+constexpr bool USE_ANALYTICS_THREAD = false;
+constexpr std::chrono::milliseconds KILL_UNHEDGED_MARGIN{2000};
+constexpr int WARM_UP_TICKS = 2000;
+constexpr unsigned long WARM_UP_PRICE = 200000;
+constexpr std::size_t WARM_UP_STACK_BYTES = 256 * 1024;
+constexpr bool USE_JOURNAL = true;
 
+// Counts instances of every strategy, for journal file names. host.cc constructs
+// traders on several threads, each must claim its own number
+static std::atomic<int> journalInstances{0};
 
-AutoTrader::AutoTrader(boost::asio::io_context& context) : BaseAutoTrader(context)
+template<typename Strategy>
+StrategyTrader<Strategy>::StrategyTrader(boost::asio::io_context& context, std::size_t journalBytes)
+    : StrategyTrader(context, nullptr)
 {
+    // One journal per instance, several can share a process (see host.cc)
+    int instance = journalInstances.fetch_add(1, std::memory_order_relaxed);
+    if (USE_JOURNAL && journalBytes) {
+        std::string fileName = "autotrader-" + std::to_string(::getpid());
+        if (instance) fileName += "-" + std::to_string(instance);
+        if (!mJournal.Open(fileName + ".journal", journalBytes)) {
+            RLOG(LG_AT, LogLevel::LL_WARNING) << "could not open journal " << fileName << ".journal";
+        }
+    }
+
+    if (PUBLISH_BROADCAST) {
+        mBroadcast = std::make_unique<BroadcastPublisher>();
+        if (!mBroadcast->IsOpen()) {
+            RLOG(LG_AT, LogLevel::LL_WARNING) << "could not create broadcast ring " << BROADCAST_NAME;
+            mBroadcast.reset();
+        }
+    }
+
+    // Runs as soon as the context starts, well inside the market open delay
+    if (WARM_UP_TICKS) {
+        boost::asio::post(context, [this, &context] { warmUp(context); });
+    }
 }
 
-void AutoTrader::DisconnectHandler()
+template<typename Strategy>
+StrategyTrader<Strategy>::StrategyTrader(boost::asio::io_context& context, SendSink* sendSink) : BaseAutoTrader(context),
+                                                             mSendSink(sendSink),
+                                                             mPriceBandLow(MIN_BID_NEARST_TICK),
+                                                             mPriceBandHigh(MAX_ASK_NEAREST_TICK),
+                                                             mAnalytics(USE_ANALYTICS_THREAD),
+                                                             mHedgeTimer(context)
 {
+}
+
+template<typename Strategy>
+void StrategyTrader<Strategy>::DisconnectHandler()
+{
+    mNow = mJournal.Stamp();
+    mJournal.Disconnect();
     BaseAutoTrader::DisconnectHandler();
     RLOG(LG_AT, LogLevel::LL_INFO) << "execution connection lost";
+    if (mJournal.Dropped()) {
+        RLOG(LG_AT, LogLevel::LL_WARNING) << "journal full, dropped " << mJournal.Dropped() << " records";
+    }
+    mFinished = true;
+    mHedgeTimer.cancel();
+    RLOG(LG_AT, LogLevel::LL_INFO) << "PNL: " << mPnl.pnl << " FEES: " << mPnl.fees
+                                   << " PEAK: " << mPnl.peakPnl << " DRAWDOWN: " << mPnl.drawdown;
+    RLOG(LG_AT, LogLevel::LL_INFO) << "HEDGES: " << mHedgeCount << " FILLED: " << mHedgeFilled << "/" << mHedgeRequested
+                                   << " SLIPPAGE PER LOT: " << (mHedgeFilled ? mHedgeSlippage / (long)mHedgeFilled : 0)
+                                   << " THROTTLE CHANGES: " << mThrottleChanges;
+    if (mUnrecognisedHedges || mLedgerFullLots || mStatusAheadOfFills) {
+        RLOG(LG_AT, LogLevel::LL_WARNING) << "UNRECOGNISED HEDGES: " << mUnrecognisedHedges
+                                          << " LOTS NOT HEDGED, LEDGER FULL: " << mLedgerFullLots
+                                          << " STATUSES AHEAD OF FILLS: " << mStatusAheadOfFills;
+    }
+
+    // Markouts per side and quote distance, the main input for choosing FUT_CLEARANCE
+    mAnalytics.Stop();
+    const MarkoutTracker& markouts = mAnalytics.Engine().Markouts();
+    for (Side side : {Side::BUY, Side::SELL}) {
+        for (int bucket = 0; bucket < MARKOUT_DISTANCE_BUCKETS; bucket++) {
+            const MarkoutTracker::Aggregate& shortest = markouts.Get(side, bucket, 0);
+            if (!shortest.volume) continue;
+            RLOG(LG_AT, LogLevel::LL_INFO) << "MARKOUTS " << (side == Side::BUY ? "BUY" : "SELL")
+                                           << " DISTANCE: " << bucket << " VOL: " << shortest.volume
+                                           << " +" << MARKOUT_HORIZONS[0] << ": " << shortest.PerLot()
+                                           << " +" << MARKOUT_HORIZONS[1] << ": " << markouts.Get(side, bucket, 1).PerLot()
+                                           << " +" << MARKOUT_HORIZONS[2] << ": " << markouts.Get(side, bucket, 2).PerLot();
+        }
+    }
 }
 
-void AutoTrader::ErrorMessageHandler(unsigned long clientOrderId,
-                                     const std::string& errorMessage)
+template<typename Strategy>
+void StrategyTrader<Strategy>::ErrorMessageHandler(unsigned long clientOrderId,
+                                                   const std::string& errorMessage)
 {
     // RLOG(LG_AT, LogLevel::LL_INFO) << "error with order " << clientOrderId << ": " << errorMessage;
+    mNow = mJournal.Stamp();
+    mJournal.Error(clientOrderId, errorMessage);
 
-    if (errorMessage[19] == 'c') {
-        // std::cout << "hehe" << std::endl;
-        if (clientOrderId == mAskId) {
-            mAskInCross = true;
-            // RLOG(LG_AT, LogLevel::LL_INFO) << "ASK IN CROSS: " << mAskId;
-        }
-        else if (clientOrderId == mBidId) mBidInCross = true;
+    if (mNow - mErrorTimes[mErrorIndex] < std::chrono::seconds(1)) {
+        tripKillSwitch("error rate");
     }
+    mErrorTimes[mErrorIndex] = mNow;
+    mErrorIndex = (mErrorIndex + 1) % KILL_ERROR_COUNT;
 
-    if (clientOrderId != 0 && ((mAsks.count(clientOrderId) == 1) || (mBids.count(clientOrderId) == 1)))
+    // Self-crosses are caught before sending (see placeAsk/placeBid), so any
+    // rejection here just retires the order and the next tick re-quotes. What
+    // it filled and paid so far stands, only the remaining volume goes.
+    if (Order* order = clientOrderId ? findOrder(clientOrderId) : nullptr)
     {
-        OrderStatusMessageHandler(clientOrderId, 0, 0, 0);
+        onOrderStatus(clientOrderId, order->filled, 0, order->fees);
     }
 }
 
-void AutoTrader::HedgeFilledMessageHandler(unsigned long clientOrderId,
-                                           unsigned long price,
-                                           unsigned long volume)
+template<typename Strategy>
+void StrategyTrader<Strategy>::HedgeFilledMessageHandler(unsigned long clientOrderId,
+                                                         unsigned long price,
+                                                         unsigned long volume)
 {
     // RLOG(LG_AT, LogLevel::LL_INFO) << "hedge order " << clientOrderId << " filled for " << volume
     //                                << " lots at $" << price << " average price in cents";
-    if (clientOrderId == mHedgeAskId) {
-        futPosition -= volume;
-        mHedgeAskId = 0;
+    mNow = mJournal.Stamp();
+    mJournal.Fill(JournalType::HEDGE_FILLED, clientOrderId, price, volume);
+    Hedge* hedge = findHedge(clientOrderId);
+    if (!hedge) {
+        mUnrecognisedHedges++;
+        return;
     }
 
-    else if (clientOrderId == mHedgeBidId) {
-        futPosition += volume;
-        mHedgeBidId = 0;
+    // A failed hedge reports zero price and volume and must not move our position
+    if (volume) {
+        hedge->filled += volume;
+        hedge->notional += price * volume;
+        futPosition += (hedge->side == Side::BUY) ? (long)volume : -(long)volume;
+        mPnl.cash += (hedge->side == Side::BUY) ? -(long)(price * volume) : (long)(price * volume);
     }
 
-    else {
-        RLOG(LG_AT, LogLevel::LL_INFO) << "Unrecognised hedge order: " << clientOrderId;
+    // Hedges execute immediately, so this is the only report we get for this one
+    Hedge settled = *hedge;
+    hedge->id = 0;
+    mHedgeInFlight -= (settled.side == Side::BUY) ? (long)settled.requested : -(long)settled.requested;
+
+    // Totals for the disconnect report, slippage against the touch when the hedge was sent
+    mHedgeCount++;
+    mHedgeRequested += settled.requested;
+    mHedgeFilled += settled.filled;
+    if (settled.filled) {
+        unsigned long averagePrice = settled.notional / settled.filled;
+        long slippage = (settled.side == Side::BUY) ? (long)averagePrice - (long)settled.touch
+                                                    : (long)settled.touch - (long)averagePrice;
+        mHedgeSlippage += slippage * (long)settled.filled;
     }
+
+    // Whatever the book could not absorb within the slippage cap is tried again at a fresh price
+    unsigned long residual = settled.requested - settled.filled;
+    if (residual && settled.retries < Strategy::HEDGE_MAX_RETRIES) {
+        sendHedge(settled.side, hedgePrice(settled.side, residual), residual, settled.retries + 1);
+    }
+
+    // Only once the ledger is settled, a kill switch tripped here flattens from a consistent position
+    if (volume) updatePnl();
+    updateHedgeTimer();
 }
 
 // Handles main logic when order book info comes through about futures or ETF
 // Note: Futures appear to come through first on each tick
 // What if we want to icnrease the volume on one of our makes because there is more availbale to us now???
 // Maybe on the futures call, just make adjustmetns based on the futures, then etf call make adjustments needed
-void AutoTrader::OrderBookMessageHandler(Instrument instrument,
-                                         unsigned long sequenceNumber,
-                                         const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
-                                         const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
-                                         const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
-                                         const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+template<typename Strategy>
+void StrategyTrader<Strategy>::OrderBookMessageHandler(Instrument instrument,
+                                                       unsigned long sequenceNumber,
+                                                       const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
+                                                       const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
+                                                       const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
+                                                       const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
 {
+    mNow = mJournal.Stamp();
+    mJournal.Book(JournalType::ORDER_BOOK, instrument, sequenceNumber, askPrices, askVolumes, bidPrices, bidVolumes);
+    if (mBroadcast) {
+        mBroadcast->Publish(BroadcastRecord::Type::ORDER_BOOK, instrument, sequenceNumber,
+                            askPrices, askVolumes, bidPrices, bidVolumes);
+    }
+
     // Copy futures info into attributes to use when the etf order message comes through after
     // See if any current order need to be altered
+    // Mark to market at the mid, keeping the last mark while a side is empty
+    if (askPrices[0] && bidPrices[0]) {
+        unsigned long mid = (askPrices[0] + bidPrices[0]) / 2;
+        if (instrument == Instrument::FUTURE) {
+            mPnl.futMark = mid;
+            mAnalytics.Post({AnalyticsEvent::Type::FUTURE_MID, Side::BUY, mid, 0, 0});
+        }
+        else mPnl.etfMark = mid;
+        updatePnl();
+    }
+
     if (instrument == Instrument::FUTURE) {
 
+        // Band has to be current before any quote below is validated against it
+        if (askPrices[0] && bidPrices[0]) {
+            updatePriceBand((askPrices[0] + bidPrices[0]) / 2);
+        }
+
+        mSignals = mAnalytics.Signals();
+        updateThrottle();
+        updateQuoteSizes(askVolumes, bidVolumes);
+
         // There are futures asks
         if (askPrices[0]) {
             // If we have an ask
             if (mAskId) {
-                // If ask is not at ideal price
-                if (mAskPrice != askPrices[0] + FUT_CLEARANCE) {
+                // If ask is not at ideal price, or we are pulling asks
+                if (mStrategy.AskThrottle() == Throttle::PULL || mAskPrice != mStrategy.AskPrice(askPrices[0])) {
                     // RLOG(LG_AT, LogLevel::LL_INFO) << "CANCELLING ASK: " << mAskId;
-                    mAskCancelId = mAskId;
-                    SendCancelOrder(mAskId);
+                    cancelOrder(mAskId);
+                    mAskId = 0;
                     makeAskBasedOnFut(askPrices[0]);
                     // RLOG(LG_AT, LogLevel::LL_INFO) << "SENDING ASK: " << mAskId;                    
                 }
@@ -129,27 +268,32 @@ void AutoTrader::OrderBookMessageHandler(Instrument instrument,
         }
 
         // If there are futures bids
-        // if we have a current bid
-        if (mBidId) {
-            // If current bid is not in optimal spot -> cancel and make new bid
-            if (mBidPrice != bidPrices[0] - FUT_CLEARANCE) {
-                
-                // RLOG(LG_AT, LogLevel::LL_INFO) << "CANCELLING BID: " << mBidId;
-                mBidCancelId = mBidId;
-                SendCancelOrder(mBidId);
+        if (bidPrices[0]) {
+            // if we have a current bid
+            if (mBidId) {
+                // If current bid is not in optimal spot, or we are pulling bids -> cancel and make new bid
+                if (mStrategy.BidThrottle() == Throttle::PULL || mBidPrice != mStrategy.BidPrice(bidPrices[0])) {
+                    // RLOG(LG_AT, LogLevel::LL_INFO) << "CANCELLING BID: " << mBidId;
+                    cancelOrder(mBidId);
+                    mBidId = 0;
+                    makeBidBasedOnFut(bidPrices[0]);
+                    // RLOG(LG_AT, LogLevel::LL_INFO) << "SENDING BID: " << mBidId;
+                }
+            }
+            // We have no curr bid -> create a new one
+            else {
                 makeBidBasedOnFut(bidPrices[0]);
                 // RLOG(LG_AT, LogLevel::LL_INFO) << "SENDING BID: " << mBidId;
             }
         }
-        // We have no curr bid -> create a new one
-        else {
-            makeBidBasedOnFut(bidPrices[0]);
-            // RLOG(LG_AT, LogLevel::LL_INFO) << "SENDING BID: " << mBidId;
-        }
 
         // Copy in futures values to be used when etf info comes through
-        // futAskPrice = askPrices[0];
-        // futBidPrice = bidPrices[0];
+        for (int i = 0; i < TOP_LEVEL_COUNT; i++) {
+            mFutAskPrices[i] = askPrices[i];
+            mFutAskVolumes[i] = askVolumes[i];
+            mFutBidPrices[i] = bidPrices[i];
+            mFutBidVolumes[i] = bidVolumes[i];
+        }
 
         // RLOG(LG_AT, LogLevel::LL_INFO) << "BID: " << bidPrices[0] << " ASK: " << askPrices[0];
     }
@@ -157,153 +301,631 @@ void AutoTrader::OrderBookMessageHandler(Instrument instrument,
     // ETF order book update
     else {
 
-        // if (ticksUnhedged % 10 == 0) {
-        //     RLOG(LG_AT, LogLevel::LL_INFO) << "SECONDS UNHEDGED: " << ticksUnhedged / 4 << "  ETF POS: " << etfPosition << " FUT POS: " << futPosition;
-            
-        // }
+        mEtfAskDepth = 0;
+        mEtfBidDepth = 0;
+        for (int i = 0; i < TOP_LEVEL_COUNT; i++) {
+            mEtfAskDepth += askVolumes[i];
+            mEtfBidDepth += bidVolumes[i];
+        }
 
-        // Check hedging info - only happens on etf order updates, 4x second
-        // If hedge is within limits
-        unsigned int unhedgedVol = abs((-etfPosition) - futPosition);
-        if (unhedgedVol <= HEDGE_LIMIT) {
-            ticksUnhedged = 0;
+        // Futures book for this tick is already in, take any cross before anything else
+        if (!mArbOrderId) {
+            takeArbitrage(askPrices, askVolumes, bidPrices, bidVolumes);
         }
-        // Hedge out of limit
-        else {
-            // See if we have been unhedged too long
-            if (ticksUnhedged > MAX_UNHEDGED_TICKS) {
-                int futTargetPosition = -etfPosition;
-                int futTargetDiff = futTargetPosition - futPosition;
-                // Need to sell hedge to get down to target fut position
-                if (futTargetDiff < 0) {
-                    // RLOG(LG_AT, LogLevel::LL_INFO) << "HEDGE, SELL VOL: " << -futTargetDiff;
-                    SendHedgeOrder(++mNextMessageId, Side::SELL, MIN_BID_NEARST_TICK, -futTargetDiff);
-                    mHedgeAskId = mNextMessageId;
-                }
-                // Need to buy to get up to fut target pos
-                else {
-                    // RLOG(LG_AT, LogLevel::LL_INFO) << "HEDGE, BUY VOL: " << futTargetDiff;
-                    SendHedgeOrder(++mNextMessageId, Side::BUY, MAX_ASK_NEAREST_TICK, futTargetDiff);
-                    mHedgeBidId = mNextMessageId;
-                }
-                ticksUnhedged = 0;
-            } else {
-                ticksUnhedged++;
+    }
+}
+
+// Walks the ETF levels against the opposite futures levels while the ETF price
+// still beats the future after the taker fee, then takes that depth with a
+// FILL_AND_KILL order. Fills are hedged from OrderFilledMessageHandler (see
+// hedgeArbitrageFill), limited at the worst futures level we counted on.
+template<typename Strategy>
+template<typename Levels>
+void StrategyTrader<Strategy>::takeArbitrage(const Levels& askPrices,
+                                             const Levels& askVolumes,
+                                             const Levels& bidPrices,
+                                             const Levels& bidVolumes)
+{
+    // Buy ETF, sell future
+    if (askPrices[0] && mFutBidPrices[0] && askPrices[0] * (1.0 + TAKER_FEE) < mFutBidPrices[0]) {
+        unsigned long volume = 0, etfPrice = 0, futPrice = 0;
+        unsigned long etfLeft = askVolumes[0], futLeft = mFutBidVolumes[0];
+        int i = 0, j = 0;
+        while (i < TOP_LEVEL_COUNT && j < TOP_LEVEL_COUNT && askPrices[i] && mFutBidPrices[j]
+               && askPrices[i] * (1.0 + TAKER_FEE) < mFutBidPrices[j]) {
+            unsigned long take = std::min(etfLeft, futLeft);
+            volume += take;
+            etfPrice = askPrices[i];
+            futPrice = mFutBidPrices[j];
+            etfLeft -= take;
+            futLeft -= take;
+            if (!etfLeft && ++i < TOP_LEVEL_COUNT) etfLeft = askVolumes[i];
+            if (!futLeft && ++j < TOP_LEVEL_COUNT) futLeft = mFutBidVolumes[j];
+        }
+        if (volume && !findCross(Side::BUY, etfPrice)) {
+            mArbOrderId = sendInsert(Side::BUY, etfPrice, volume, Lifespan::FILL_AND_KILL);
+            mArbHedgePrice = futPrice;
+        }
+        return;
+    }
+
+    // Sell ETF, buy future
+    if (bidPrices[0] && mFutAskPrices[0] && bidPrices[0] * (1.0 - TAKER_FEE) > mFutAskPrices[0]) {
+        unsigned long volume = 0, etfPrice = 0, futPrice = 0;
+        unsigned long etfLeft = bidVolumes[0], futLeft = mFutAskVolumes[0];
+        int i = 0, j = 0;
+        while (i < TOP_LEVEL_COUNT && j < TOP_LEVEL_COUNT && bidPrices[i] && mFutAskPrices[j]
+               && bidPrices[i] * (1.0 - TAKER_FEE) > mFutAskPrices[j]) {
+            unsigned long take = std::min(etfLeft, futLeft);
+            volume += take;
+            etfPrice = bidPrices[i];
+            futPrice = mFutAskPrices[j];
+            etfLeft -= take;
+            futLeft -= take;
+            if (!etfLeft && ++i < TOP_LEVEL_COUNT) etfLeft = bidVolumes[i];
+            if (!futLeft && ++j < TOP_LEVEL_COUNT) futLeft = mFutAskVolumes[j];
+        }
+        if (volume && !findCross(Side::SELL, etfPrice)) {
+            mArbOrderId = sendInsert(Side::SELL, etfPrice, volume, Lifespan::FILL_AND_KILL);
+            mArbHedgePrice = futPrice;
+        }
+    }
+}
+
+// Keeps the hedge deadline in step with our positions, called whenever either changes.
+// The deadline runs from when we first went over HEDGE_LIMIT, so retries and partial
+// hedges do not restart the window the exchange is measuring.
+template<typename Strategy>
+void StrategyTrader<Strategy>::updateHedgeTimer()
+{
+    static_assert(Strategy::HEDGE_NETTED_MARGIN > Strategy::HEDGE_SAFETY_MARGIN,
+                  "the final hedge comes after the netted hedge");
+    static_assert(Strategy::HEDGE_SAFETY_MARGIN >= KILL_UNHEDGED_MARGIN + std::chrono::seconds(1),
+                  "the final hedge needs time for its retries before the kill switch");
+
+    // After the kill switch no quote will offset anything, so fills still landing
+    // on orders being cancelled are hedged in full
+    unsigned long unhedgedVol = std::abs(etfPosition + futPosition);
+    unsigned long limit = mKilled ? 0 : Strategy::HEDGE_LIMIT;
+    if (unhedgedVol <= limit) {
+        mHedgeTimerArmed = false;
+        mUnhedgedSince = {};
+        return;
+    }
+
+    if (mHedgeTimerArmed) return;
+
+    if (mUnhedgedSince == std::chrono::steady_clock::time_point{}) mUnhedgedSince = mNow;
+
+    // Three wake-ups per window: the netted hedge, the final hedge and the kill
+    // switch check, each armed once the one before it is past, so nothing
+    // re-hedges in a loop
+    mHedgeTimerArmed = true;
+    mHedgeDeadline = mUnhedgedSince + UNHEDGED_TIME_LIMIT - Strategy::HEDGE_NETTED_MARGIN;
+    if (mHedgeDeadline <= mNow) {
+        mHedgeDeadline = mUnhedgedSince + UNHEDGED_TIME_LIMIT - Strategy::HEDGE_SAFETY_MARGIN;
+    }
+    if (mHedgeDeadline <= mNow) {
+        mHedgeDeadline = std::max(mUnhedgedSince + UNHEDGED_TIME_LIMIT - KILL_UNHEDGED_MARGIN, mNow);
+    }
+    if (!mHedgeWaitPending) waitForHedgeDeadline();
+}
+
+// Cancelling a wait and starting another leaves the cancelled operation queued
+// until the handler returns, so every re-arm would allocate a fresh one. Instead
+// a wait is never cancelled while trading: one left over from an earlier deadline
+// always expires before the current deadline, and is renewed when it completes.
+template<typename Strategy>
+void StrategyTrader<Strategy>::waitForHedgeDeadline()
+{
+    mHedgeWaitPending = true;
+    mHedgeTimer.expires_at(mHedgeDeadline);
+    mHedgeTimer.async_wait([this](const boost::system::error_code& error) {
+        // Only cancelled on disconnect or destruction, when this may be gone
+        if (error) return;
+        mHedgeWaitPending = false;
+        if (!mHedgeTimerArmed) return;
+        if (mHedgeTimer.expiry() < mHedgeDeadline) waitForHedgeDeadline();
+        else hedgeTimerExpired();
+    });
+}
+
+// The deadline timer is an input like any message, so it is stamped and journalled
+template<typename Strategy>
+void StrategyTrader<Strategy>::hedgeTimerExpired()
+{
+    mNow = mJournal.Stamp();
+    mJournal.Timer();
+    mHedgeTimerArmed = false;
+    hedgeDeadlineHandler();
+}
+
+// Hedge planner, run at the latest safe moments of the unhedged window so that every
+// fill inside the window goes out as one hedge. Fires whether or not market data is
+// flowing. Nets hedges already in flight and only hedges back down to HEDGE_LIMIT,
+// or to flat once the kill switch has tripped. The first wake-up also nets the
+// quotes that would reduce the exposure if they traded; the final one does not, so
+// quotes that never fill cannot run the window out.
+template<typename Strategy>
+void StrategyTrader<Strategy>::hedgeDeadlineHandler()
+{
+    auto elapsed = mNow - mUnhedgedSince;
+
+    // Still unhedged after the final hedge and its retries means hedging is not working
+    if (!mKilled && elapsed >= UNHEDGED_TIME_LIMIT - KILL_UNHEDGED_MARGIN) {
+        tripKillSwitch("unhedged time");
+        return;
+    }
+
+    long exposure = etfPosition + futPosition + mHedgeInFlight;
+    Side side = exposure > 0 ? Side::SELL : Side::BUY;
+    long excess = std::abs(exposure) - (mKilled ? 0 : Strategy::HEDGE_LIMIT);
+
+    // Arbitrage fills carry their own hedge, so a live arbitrage order offsets nothing
+    if (!mKilled && elapsed < UNHEDGED_TIME_LIMIT - Strategy::HEDGE_SAFETY_MARGIN) {
+        for (const Order& order : mOrders) {
+            if (order.id && order.side == side && !order.cancelling && order.id != mArbOrderId) {
+                excess -= (long)order.volume;
             }
         }
     }
+
+    // RLOG(LG_AT, LogLevel::LL_INFO) << "HEDGE VOL: " << excess << " EXPOSURE: " << exposure;
+    if (excess > 0) hedge(side, excess);
+
+    // The next wake-up must not wait for a fill to arm it
+    if (elapsed < UNHEDGED_TIME_LIMIT - KILL_UNHEDGED_MARGIN) updateHedgeTimer();
+}
+
+// Arbitrage fills are hedged in full straight away at the futures price they were
+// sized against, the edge is only locked in once both legs are on. HEDGE_LIMIT
+// netting is for quoting exposure and is left to the deadline planner.
+template<typename Strategy>
+void StrategyTrader<Strategy>::hedgeArbitrageFill(Side side, unsigned long volume)
+{
+    sendHedge(side == Side::BUY ? Side::SELL : Side::BUY, mArbHedgePrice, volume, 0);
+}
+
+// Starts a new hedge priced off the latest futures depth
+template<typename Strategy>
+void StrategyTrader<Strategy>::hedge(Side side, unsigned long volume)
+{
+    sendHedge(side, hedgePrice(side, volume), volume, 0);
+}
+
+template<typename Strategy>
+void StrategyTrader<Strategy>::sendHedge(Side side, unsigned long price, unsigned long volume, int retries)
+{
+    Hedge* hedge = findHedge(0);
+    if (!hedge) {
+        mLedgerFullLots += volume;
+        return;
+    }
+
+    // A hedge that trips the kill switch is covered by the flatten, which has
+    // already sent from this slot
+    if (!countMessage()) return;
+    ++mNextMessageId;
+    mJournal.Send(JournalType::HEDGE_ORDER, mNextMessageId, side, price, volume, Lifespan::FILL_AND_KILL);
+    if (mSendSink) mSendSink->HedgeOrder(mNextMessageId, side, price, volume);
+    else SendHedgeOrder(mNextMessageId, side, price, volume);
+    *hedge = {mNextMessageId, side, volume, 0, 0, (side == Side::BUY) ? mFutAskPrices[0] : mFutBidPrices[0], retries};
+    mHedgeInFlight += (side == Side::BUY) ? (long)volume : -(long)volume;
+}
+
+// Looking up id zero finds a free slot
+template<typename Strategy>
+typename StrategyTrader<Strategy>::Hedge* StrategyTrader<Strategy>::findHedge(unsigned long clientOrderId)
+{
+    for (Hedge& hedge : mHedgeLedger) {
+        if (hedge.id == clientOrderId) return &hedge;
+    }
+    return nullptr;
+}
+
+// Priced by the strategy from the futures side the hedge trades against. If the
+// visible depth is not enough the hedge fills what it can and the residual is
+// retried from HedgeFilledMessageHandler.
+template<typename Strategy>
+unsigned long StrategyTrader<Strategy>::hedgePrice(Side side, unsigned long volume) const
+{
+    if (side == Side::BUY) return mStrategy.HedgePrice(side, volume, mFutAskPrices, mFutAskVolumes);
+    return mStrategy.HedgePrice(side, volume, mFutBidPrices, mFutBidVolumes);
+}
+
+template<typename Strategy>
+void StrategyTrader<Strategy>::makeAskBasedOnFut(unsigned long futBestAskPrice) {
+    if (mStrategy.AskThrottle() == Throttle::PULL) {
+        mDeferredAskPrice = 0;
+        return;
+    }
+    placeAsk(mStrategy.AskPrice(futBestAskPrice));
 }
 
-void AutoTrader::makeAskBasedOnFut(unsigned long futBestAskPrice) {
+template<typename Strategy>
+void StrategyTrader<Strategy>::makeBidBasedOnFut(unsigned long futBestBidPrice) {
+    if (mStrategy.BidThrottle() == Throttle::PULL) {
+        mDeferredBidPrice = 0;
+        return;
+    }
+    placeBid(mStrategy.BidPrice(futBestBidPrice));
+}
+
+// Per side quote throttle from this tick's signals, decided by the strategy
+template<typename Strategy>
+void StrategyTrader<Strategy>::updateThrottle() {
+    if (mStrategy.UpdateThrottle(mSignals)) mThrottleChanges++;
+}
+
+// If the new ask would trade against one of our own bids, cancel that bid and
+// hold the ask back until the exchange confirms the bid is gone
+template<typename Strategy>
+void StrategyTrader<Strategy>::placeAsk(unsigned long price) {
+    mAskPrice = price;
+
+    if (Order* crossed = findCross(Side::SELL, price)) {
+        cancelOrder(crossed->id);
+        mDeferredAskPrice = price;
+        return;
+    }
+    mDeferredAskPrice = 0;
+
     unsigned long makeAskVol = maxAskVol();
     if (makeAskVol) {
+        unsigned long id = sendInsert(Side::SELL, price, makeAskVol, Lifespan::GOOD_FOR_DAY);
+        if (id) mAskId = id;
+    }
+}
 
-        mAskPrice = futBestAskPrice + FUT_CLEARANCE;
+template<typename Strategy>
+void StrategyTrader<Strategy>::placeBid(unsigned long price) {
+    mBidPrice = price;
 
-        SendInsertOrder(++mNextMessageId, Side::SELL, mAskPrice, makeAskVol, Lifespan::GOOD_FOR_DAY);
-        mAskId = mNextMessageId;
-        mAskVol = makeAskVol;
-        mAsks.insert(mAskId);
+    if (Order* crossed = findCross(Side::BUY, price)) {
+        cancelOrder(crossed->id);
+        mDeferredBidPrice = price;
+        return;
     }
-}
+    mDeferredBidPrice = 0;
 
-void AutoTrader::makeBidBasedOnFut(unsigned long futBestBidPrice) {
     unsigned long makeBidVol = maxBidVol();
     if (makeBidVol) {
+        unsigned long id = sendInsert(Side::BUY, price, makeBidVol, Lifespan::GOOD_FOR_DAY);
+        if (id) mBidId = id;
+    }
+}
+
+// Called whenever an order leaves the table; sends any quote that was waiting on it
+template<typename Strategy>
+void StrategyTrader<Strategy>::releaseDeferredQuotes() {
+    if (mDeferredAskPrice && !findCross(Side::SELL, mDeferredAskPrice)) {
+        placeAsk(mDeferredAskPrice);
+    }
+    if (mDeferredBidPrice && !findCross(Side::BUY, mDeferredBidPrice)) {
+        placeBid(mDeferredBidPrice);
+    }
+}
+
+template<typename Strategy>
+unsigned long StrategyTrader<Strategy>::maxAskVol() {
+    return mStrategy.AskSize();
+}
+
+template<typename Strategy>
+unsigned long StrategyTrader<Strategy>::maxBidVol() {
+    return mStrategy.BidSize();
+}
+
+// Works out quote sizes once per tick so the insert path only reads them. The
+// strategy sizes from the visible depth on both books, the signals and our
+// position; the risk gate still has the final say on every insert.
+template<typename Strategy>
+template<typename Levels>
+void StrategyTrader<Strategy>::updateQuoteSizes(const Levels& futAskVolumes,
+                                                const Levels& futBidVolumes) {
+    unsigned long futAskDepth = 0, futBidDepth = 0;
+    for (int i = 0; i < TOP_LEVEL_COUNT; i++) {
+        futAskDepth += futAskVolumes[i];
+        futBidDepth += futBidVolumes[i];
+    }
+
+    mStrategy.UpdateSizes(mEtfAskDepth, mEtfBidDepth, futAskDepth, futBidDepth, mSignals, etfPosition);
+}
+
+template<typename Strategy>
+unsigned long StrategyTrader<Strategy>::sendInsert(Side side, unsigned long price, unsigned long volume, Lifespan lifespan)
+{
+    if (mKilled) return 0;
+
+    price = validatePrice(side, price);
+    if (!price) return 0;
+
+    volume = riskClipVolume(side, volume);
+    if (!volume) return 0;
+
+    // If this message trips the rate limit the kill switch has already cancelled
+    // everything, so this insert must not go out after it
+    if (!countMessage()) return 0;
+    ++mNextMessageId;
+    mJournal.Send(JournalType::INSERT_ORDER, mNextMessageId, side, price, volume, lifespan);
+    if (mSendSink) mSendSink->InsertOrder(mNextMessageId, side, price, volume, lifespan);
+    else SendInsertOrder(mNextMessageId, side, price, volume, lifespan);
+
+    // Table has a free slot, riskClipVolume checked the live order count
+    for (Order& order : mOrders) {
+        if (!order.id) {
+            order = {mNextMessageId, side, price, volume};
+            break;
+        }
+    }
+    mLiveOrderCount++;
+    if (side == Side::SELL) mLiveAskVolume += volume;
+    else mLiveBidVolume += volume;
+
+    return mNextMessageId;
+}
+
+// The order table bounds the live order count, the strategy's risk policy clips
+// the volume. Both work from the running totals so this is O(1).
+template<typename Strategy>
+unsigned long StrategyTrader<Strategy>::riskClipVolume(Side side, unsigned long volume) const
+{
+    if (mLiveOrderCount >= ACTIVE_ORDER_COUNT_LIMIT) return 0;
+    return mStrategy.ClipVolume(side, volume, etfPosition, mLiveBidVolume, mLiveAskVolume);
+}
 
-        mBidPrice = futBestBidPrice - FUT_CLEARANCE;
+// ETF orders priced further than ETF_CLAMP from the reference price are rejected,
+// so keep the allowed band (on whole ticks) ready for validatePrice
+template<typename Strategy>
+void StrategyTrader<Strategy>::updatePriceBand(unsigned long referencePrice)
+{
+    unsigned long low = (unsigned long)std::ceil(referencePrice * (1.0 - ETF_CLAMP) / TICK_SIZE_IN_CENTS);
+    unsigned long high = (unsigned long)std::floor(referencePrice * (1.0 + ETF_CLAMP) / TICK_SIZE_IN_CENTS);
+    mPriceBandLow = std::max(low * TICK_SIZE_IN_CENTS, (unsigned long)MIN_BID_NEARST_TICK);
+    mPriceBandHigh = std::min(high * TICK_SIZE_IN_CENTS, (unsigned long)MAX_ASK_NEAREST_TICK);
+}
 
-        SendInsertOrder(++mNextMessageId, Side::BUY, mBidPrice, makeBidVol, Lifespan::GOOD_FOR_DAY);
-        mBidId = mNextMessageId;
-        mBids.insert(mBidId);
-        mBidVol = makeBidVol;
+// Rounds to the tick away from the touch and pulls prices that are too aggressive
+// back to the band edge. Prices too passive to be accepted return zero (suppressed).
+template<typename Strategy>
+unsigned long StrategyTrader<Strategy>::validatePrice(Side side, unsigned long price) const
+{
+    if (side == Side::BUY) {
+        price = price / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
+        if (price > mPriceBandHigh) price = mPriceBandHigh;
+        return (price < mPriceBandLow) ? 0 : price;
     }
+
+    price = (price + TICK_SIZE_IN_CENTS - 1) / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
+    if (price < mPriceBandLow) price = mPriceBandLow;
+    return (price > mPriceBandHigh) ? 0 : price;
 }
 
-unsigned long AutoTrader::maxAskVol() {
-    return (POSITION_LIMIT + etfPosition) / 2;
+// First live order on the opposite side that an order at this price would trade with
+template<typename Strategy>
+typename StrategyTrader<Strategy>::Order* StrategyTrader<Strategy>::findCross(Side side, unsigned long price)
+{
+    for (Order& order : mOrders) {
+        if (!order.id || order.side == side) continue;
+        if (side == Side::BUY ? order.price <= price : order.price >= price) return &order;
+    }
+    return nullptr;
 }
 
-unsigned long AutoTrader::maxBidVol() {
-    return (POSITION_LIMIT - etfPosition) / 2;
+// Cancels at most once per order, the order stays live until the exchange confirms
+template<typename Strategy>
+void StrategyTrader<Strategy>::cancelOrder(unsigned long clientOrderId)
+{
+    Order* order = findOrder(clientOrderId);
+    if (!order || order->cancelling) return;
+
+    // Tripping the kill switch here cancels this order along with the rest
+    if (!countMessage()) return;
+    order->cancelling = true;
+    mJournal.Send(JournalType::CANCEL_ORDER, clientOrderId, order->side, 0, 0, Lifespan::GOOD_FOR_DAY);
+    if (mSendSink) mSendSink->CancelOrder(clientOrderId);
+    else SendCancelOrder(clientOrderId);
 }
 
-void AutoTrader::OrderFilledMessageHandler(unsigned long clientOrderId,
-                                           unsigned long price,
-                                           unsigned long volume)
+template<typename Strategy>
+typename StrategyTrader<Strategy>::Order* StrategyTrader<Strategy>::findOrder(unsigned long clientOrderId)
+{
+    for (Order& order : mOrders) {
+        if (order.id == clientOrderId) return &order;
+    }
+    return nullptr;
+}
+
+// Lower the volume we count as live for an order
+template<typename Strategy>
+void StrategyTrader<Strategy>::reduceOrder(Order& order, unsigned long newVolume)
+{
+    if (newVolume >= order.volume) return;
+
+    unsigned long reduction = order.volume - newVolume;
+    if (order.side == Side::SELL) mLiveAskVolume -= reduction;
+    else mLiveBidVolume -= reduction;
+    order.volume = newVolume;
+}
+
+template<typename Strategy>
+void StrategyTrader<Strategy>::OrderFilledMessageHandler(unsigned long clientOrderId,
+                                                         unsigned long price,
+                                                         unsigned long volume)
 {
     // RLOG(LG_AT, LogLevel::LL_INFO) << "ORDER FILLED: " << clientOrderId << " PRICE: " << price << " VOL: " << volume;
-    if (mAsks.count(clientOrderId) == 1)
+    mNow = mJournal.Stamp();
+    mJournal.Fill(JournalType::ORDER_FILLED, clientOrderId, price, volume);
+    Order* order = findOrder(clientOrderId);
+    if (!order) {
+        for (Order& retired : mRetiredOrders) {
+            if (retired.id == clientOrderId) {
+                repriceHealedFill(retired, price, volume);
+                if (!retired.healed) retired.id = 0;
+                return;
+            }
+        }
+        return;
+    }
+
+    // Only what the status updates have not already accounted for moves our position
+    order->fillsReported += volume;
+    repriceHealedFill(*order, price, volume);
+    if (order->fillsReported > order->filled) {
+        applyFill(*order, price, order->fillsReported - order->filled);
+    }
+
+    // RLOG(LG_AT, LogLevel::LL_INFO) << "order " << clientOrderId << " filled for " << volume
+    //                                << " lots at $" << price << " cents";
+}
+
+// A fill for volume a status update healed at the order price only moves the
+// cash, by the difference to the price it really traded at
+template<typename Strategy>
+void StrategyTrader<Strategy>::repriceHealedFill(Order& order, unsigned long price, unsigned long volume)
+{
+    unsigned long late = std::min(volume, order.healed);
+    if (!late) return;
+
+    order.healed -= late;
+    long difference = ((long)price - (long)order.price) * (long)late;
+    mPnl.cash += (order.side == Side::BUY) ? -difference : difference;
+    updatePnl();
+}
+
+// Fees are positive when paid, negative for maker rebates
+template<typename Strategy>
+void StrategyTrader<Strategy>::updatePnl()
+{
+    mPnl.pnl = mPnl.cash - mPnl.fees + etfPosition * (long)mPnl.etfMark + futPosition * (long)mPnl.futMark;
+
+    // Against a zero mark the PnL is just cash, so it must not set the peak or
+    // trip the kill switch until both books have been seen
+    if (!mPnl.etfMark || !mPnl.futMark) return;
+    mPnl.peakPnl = std::max(mPnl.peakPnl, mPnl.pnl);
+    mPnl.drawdown = mPnl.peakPnl - mPnl.pnl;
+
+    if (mPnl.drawdown > Strategy::KILL_MAX_DRAWDOWN) tripKillSwitch("drawdown");
+}
+
+// Records a message against the rate budget, tripping the kill switch while there
+// is still budget left to cancel everything. Returns false when this message
+// tripped it, the caller must then not send
+template<typename Strategy>
+bool StrategyTrader<Strategy>::countMessage()
+{
+    if (!mKilled && mNow - mMessageTimes[mMessageIndex] < std::chrono::seconds(1)) {
+        tripKillSwitch("message rate");
+        return false;
+    }
+    mMessageTimes[mMessageIndex] = mNow;
+    mMessageIndex = (mMessageIndex + 1) % KILL_MESSAGE_COUNT;
+    return true;
+}
+
+// Stops all new inserts, cancels every live order in one burst and hedges out
+// whatever imbalance is left between the ETF and future positions
+template<typename Strategy>
+void StrategyTrader<Strategy>::tripKillSwitch(const char* reason)
+{
+    if (mKilled) return;
+    mKilled = true;
+    RLOG(LG_AT, LogLevel::LL_WARNING) << "KILL SWITCH: " << reason << " ETF POS: " << etfPosition
+                                      << " FUT POS: " << futPosition << " PNL: " << mPnl.pnl;
+
+    mDeferredAskPrice = 0;
+    mDeferredBidPrice = 0;
+    for (const Order& order : mOrders) {
+        if (order.id) cancelOrder(order.id);
+    }
+
+    long exposure = etfPosition + futPosition + mHedgeInFlight;
+    if (exposure) {
+        hedge(exposure > 0 ? Side::SELL : Side::BUY, std::abs(exposure));
+    }
+}
+
+// Moves filled volume from live to position, so worst-case exposure is unchanged
+template<typename Strategy>
+void StrategyTrader<Strategy>::applyFill(Order& order, unsigned long price, unsigned long volume)
+{
+    order.filled += volume;
+    mPnl.cash += (order.side == Side::BUY) ? -(long)(price * volume) : (long)(price * volume);
+    if (mPnl.futMark) {
+        unsigned long distance = (price > mPnl.futMark ? price - mPnl.futMark : mPnl.futMark - price) / TICK_SIZE_IN_CENTS;
+        mAnalytics.Post({AnalyticsEvent::Type::FILL, order.side, price, volume, distance});
+    }
+    reduceOrder(order, order.volume > volume ? order.volume - volume : 0);
+
+    if (order.side == Side::SELL)
     {
         etfPosition -= (long)volume;
         // SendHedgeOrder(++mNextMessageId, Side::BUY, MAX_ASK_NEAREST_TICK, volume);
-        
-        // If this was the previous ask that we attempted to cancel
-        if (clientOrderId == mAskCancelId) {
-            // If most recent bid was cancelled for being in cross with the ask that just got cancelled/filled -> resend bid
-            if (mBidInCross) {
-                RLOG(LG_AT, LogLevel::LL_INFO) << "REPLACING CROSSED BID: " << mBidId;               
-                makeBidBasedOnFut(mBidPrice);
-                mBidInCross = false;
-            }
-            
-            // Check if most recent ask has too much volume in case this order was filled when it should have been cancelled
-            unsigned long newVol = maxAskVol();
-            if (newVol < mAskVol) {
-                SendAmendOrder(mAskId, newVol);
-                // RLOG(LG_AT, LogLevel::LL_INFO) << "ORDER AMENDED: " << mAskId << " FROM: " << mAskVol << " TO: " << newVol;
-                mBidVol = newVol;
-            }
-        }
     }
-    else if (mBids.count(clientOrderId) == 1)
+    else
     {
         etfPosition += (long)volume;
         // SendHedgeOrder(++mNextMessageId, Side::SELL, MIN_BID_NEARST_TICK, volume);
+    }
 
-        // If this was the prev bid we attempted to cancel
-        if (clientOrderId == mBidCancelId) {
-
-            // If most recent ask was cancelled for being in cross with this order that just got cancelled/filled -> resend ask
-            if (mAskInCross) {
-                RLOG(LG_AT, LogLevel::LL_INFO) << "REPLACING CROSSED ASK: " << mAskId;
-                makeAskBasedOnFut(mAskPrice);
-                mAskInCross = false;
-            }
-
-            // Check if most recent bid now has too much volume in case prev bid filled not cancelled
-            unsigned long newVol = maxBidVol();
-            if (newVol < mBidVol) {
-                SendAmendOrder(mBidId, newVol);
-                // RLOG(LG_AT, LogLevel::LL_INFO) << "ORDER AMENDED: " << mBidId << " FROM: " << mBidVol << " TO: " << newVol;
-                mBidVol = newVol;
-            }
-        }
+    // Hedged before the PnL update, so a kill switch tripped there counts this hedge as in flight
+    if (order.id == mArbOrderId) {
+        hedgeArbitrageFill(order.side, volume);
     }
-    // RLOG(LG_AT, LogLevel::LL_INFO) << "order " << clientOrderId << " filled for " << volume
-    //                                << " lots at $" << price << " cents";
+    updatePnl();
+    updateHedgeTimer();
 }
 
-void AutoTrader::OrderStatusMessageHandler(unsigned long clientOrderId,
-                                           unsigned long fillVolume,
-                                           unsigned long remainingVolume,
-                                           signed long fees)
+template<typename Strategy>
+void StrategyTrader<Strategy>::OrderStatusMessageHandler(unsigned long clientOrderId,
+                                                         unsigned long fillVolume,
+                                                         unsigned long remainingVolume,
+                                                         signed long fees)
 {
     // RLOG(LG_AT, LogLevel::LL_INFO) << "Order status update: " << clientOrderId;
+    mNow = mJournal.Stamp();
+    mJournal.Status(clientOrderId, fillVolume, remainingVolume, fees);
+    onOrderStatus(clientOrderId, fillVolume, remainingVolume, fees);
+}
+
+// Also used for rejections, which are not journalled a second time as a status
+template<typename Strategy>
+void StrategyTrader<Strategy>::onOrderStatus(unsigned long clientOrderId,
+                                             unsigned long fillVolume,
+                                             unsigned long remainingVolume,
+                                             signed long fees)
+{
+
+    Order* order = findOrder(clientOrderId);
+    if (!order) return;
+
+    // Fill volume here is cumulative and should match the fills we have been told
+    // about. If it is ahead the fills are late, or lost, so heal the position now
+    // at the order price; a late fill then corrects the cash (repriceHealedFill).
+    if (fillVolume > order->filled) {
+        mStatusAheadOfFills++;
+        order->healed += fillVolume - order->filled;
+        applyFill(*order, order->price, fillVolume - order->filled);
+    }
+
+    // Fees are also cumulative per order
+    if (fees != order->fees) {
+        mPnl.fees += fees - order->fees;
+        order->fees = fees;
+        updatePnl();
+    }
+
+    // Covers cancels and amends as well as fills
+    reduceOrder(*order, remainingVolume);
 
     if (!remainingVolume)
     {
-
-        if (clientOrderId == mBidCancelId && mAskInCross) {
-            // RLOG(LG_AT, LogLevel::LL_INFO) << "REPLACING CROSSED ASK: " << mAskId << " FINISHED ORDER: " << clientOrderId << " PRICE: " << mAskPrice << " VOL: " << mAskVol;
-            makeAskBasedOnFut(mAskPrice);
-            mAskInCross = false;
-        }
-        else if (clientOrderId == mAskCancelId && mBidInCross) {
-            // RLOG(LG_AT, LogLevel::LL_INFO) << "REPLACING CROSSED BID: " << mBidId << " FINISHED ORDER: " << clientOrderId << " PRICE: " << mBidPrice << " VOL: " << mBidVol;               
-            makeBidBasedOnFut(mBidPrice);
-            mBidInCross = false;
+        if (order->healed) {
+            mRetiredOrders[mRetiredIndex] = *order;
+            mRetiredIndex = (mRetiredIndex + 1) % RETIRED_ORDER_COUNT;
         }
+        order->id = 0;
+        mLiveOrderCount--;
 
         if (clientOrderId == mAskId)
         {
@@ -313,20 +935,31 @@ void AutoTrader::OrderStatusMessageHandler(unsigned long clientOrderId,
         {
             mBidId = 0;
         }
+        else if (clientOrderId == mArbOrderId)
+        {
+            mArbOrderId = 0;
+            updateHedgeTimer();
+        }
 
-        mAsks.erase(clientOrderId);
-        mBids.erase(clientOrderId);
-
+        releaseDeferredQuotes();
     }
 }
 
-void AutoTrader::TradeTicksMessageHandler(Instrument instrument,
-                                          unsigned long sequenceNumber,
-                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
-                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
-                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
-                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+template<typename Strategy>
+void StrategyTrader<Strategy>::TradeTicksMessageHandler(Instrument instrument,
+                                                        unsigned long sequenceNumber,
+                                                        const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
+                                                        const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
+                                                        const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
+                                                        const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
 {
+    mNow = mJournal.Stamp();
+    mJournal.Book(JournalType::TRADE_TICKS, instrument, sequenceNumber, askPrices, askVolumes, bidPrices, bidVolumes);
+    if (mBroadcast) {
+        mBroadcast->Publish(BroadcastRecord::Type::TRADE_TICKS, instrument, sequenceNumber,
+                            askPrices, askVolumes, bidPrices, bidVolumes);
+    }
+
     // RLOG(LG_AT, LogLevel::LL_INFO) << "trade ticks received for " << instrument << " instrument"
     //                                << ": ask prices: " << askPrices[0]
     //                                << "; ask volumes: " << askVolumes[0]
@@ -335,4 +968,93 @@ void AutoTrader::TradeTicksMessageHandler(Instrument instrument,
 
     // RLOG(LG_AT, LogLevel::LL_INFO) << "Trade tick: " << ticks++;
 
-}
\ No newline at end of file
+    // Trading at the asks is aggressive buying, at the bids aggressive selling
+    if (instrument == Instrument::ETF) {
+        unsigned long bought = 0, sold = 0;
+        for (int i = 0; i < TOP_LEVEL_COUNT; i++) {
+            bought += askVolumes[i];
+            sold += bidVolumes[i];
+        }
+        mAnalytics.Post({AnalyticsEvent::Type::ETF_TRADES, Side::BUY, 0, bought, sold});
+    }
+}
+
+// Drives a scratch copy of the trader through synthetic ticks, fills and hedge
+// reports so that the first live tick finds warm caches and trained branches,
+// then locks and pre-faults this process's memory. All trader state lives in
+// fixed size arrays, so there are no containers to grow later.
+template<typename Strategy>
+void StrategyTrader<Strategy>::warmUp(boost::asio::io_context& context)
+{
+    auto start = std::chrono::steady_clock::now();
+    NullSendSink nullSink;
+    auto scratch = std::make_unique<StrategyTrader>(context, &nullSink);
+
+    std::array<unsigned long, TOP_LEVEL_COUNT> askPrices, askVolumes, bidPrices, bidVolumes;
+    for (int tick = 0; tick < WARM_UP_TICKS; tick++) {
+        // Triangle wave of +-5 ticks keeps the drawdown well inside the kill switch
+        long offset = std::abs(tick % 20 - 10) - 5;
+        unsigned long mid = WARM_UP_PRICE + offset * TICK_SIZE_IN_CENTS;
+
+        // Synthetic messages arrive far faster than the exchange allows
+        scratch->mMessageTimes = {};
+
+        for (int i = 0; i < TOP_LEVEL_COUNT; i++) {
+            askPrices[i] = mid + (i + 1) * TICK_SIZE_IN_CENTS;
+            bidPrices[i] = mid - (i + 1) * TICK_SIZE_IN_CENTS;
+            askVolumes[i] = bidVolumes[i] = 20 + 10 * i;
+        }
+        scratch->OrderBookMessageHandler(Instrument::FUTURE, tick, askPrices, askVolumes, bidPrices, bidVolumes);
+
+        // Every seventh ETF book crosses the futures to exercise the arbitrage path
+        long skew = (tick % 7 == 0) ? ((tick % 14 == 0) ? 3 : -3) * TICK_SIZE_IN_CENTS : 0;
+        for (int i = 0; i < TOP_LEVEL_COUNT; i++) {
+            askPrices[i] += skew;
+            bidPrices[i] += skew;
+        }
+        scratch->OrderBookMessageHandler(Instrument::ETF, tick, askPrices, askVolumes, bidPrices, bidVolumes);
+        scratch->TradeTicksMessageHandler(Instrument::ETF, tick, askPrices, askVolumes, bidPrices, bidVolumes);
+
+        // Confirm cancels and take the arbitrage order out, part fill quotes every few ticks
+        for (const Order& order : scratch->mOrders) {
+            if (!order.id) continue;
+            unsigned long id = order.id, price = order.price, volume = order.volume, filled = order.filled;
+            if (order.cancelling) {
+                scratch->OrderStatusMessageHandler(id, filled, 0, order.fees);
+            }
+            else if (id == scratch->mArbOrderId) {
+                scratch->OrderFilledMessageHandler(id, price, volume);
+                scratch->OrderStatusMessageHandler(id, filled + volume, 0, 0);
+            }
+            else if (tick % 3 == 0) {
+                scratch->OrderFilledMessageHandler(id, price, 1);
+                scratch->OrderStatusMessageHandler(id, filled + 1, volume - 1, -1);
+            }
+        }
+
+        for (const Hedge& hedge : scratch->mHedgeLedger) {
+            if (hedge.id) {
+                scratch->HedgeFilledMessageHandler(hedge.id, mid, hedge.requested);
+            }
+        }
+    }
+    scratch.reset();
+
+    // Touch the stack the handlers will run on, then pin what is mapped now: the
+    // journal and broadcast rings were mapped in the constructor. MCL_FUTURE would
+    // also pin every later mapping, such as other host threads' stacks, and those
+    // would start failing once RLIMIT_MEMLOCK is used up.
+    volatile char stack[WARM_UP_STACK_BYTES];
+    for (std::size_t i = 0; i < WARM_UP_STACK_BYTES; i += 4096) stack[i] = 0;
+    (void)stack[0];
+    if (mlockall(MCL_CURRENT) != 0) {
+        RLOG(LG_AT, LogLevel::LL_WARNING) << "could not lock memory, check RLIMIT_MEMLOCK";
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    RLOG(LG_AT, LogLevel::LL_INFO) << "warmed up on " << WARM_UP_TICKS << " ticks in " << elapsed.count() << "us";
+}
+
+// Every composition the tools and the host run, see strategy.h
+template class StrategyTrader<DefaultStrategy>;
+template class StrategyTrader<HalfRoomStrategy>;
@@ -19,21 +19,79 @@
 #define CPPREADY_TRADER_GO_AUTOTRADER_H
 
 #include <array>
+#include <chrono>
 #include <memory>
 #include <string>
-#include <unordered_set>
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
 
 #include <ready_trader_go/baseautotrader.h>
 #include <ready_trader_go/types.h>
 
+#include "analytics.h"
+#include "broadcast.h"
+#include "journal.h"
+#include "sendsink.h"
+#include "strategy.h"
+
 #include <ctime>
 
-class AutoTrader : public ReadyTraderGo::BaseAutoTrader
+// Exchange limits from exchange.json, needed here to size the order table,
+// and room for overlapping hedges
+constexpr int ACTIVE_ORDER_COUNT_LIMIT = 10;
+constexpr int MESSAGE_FREQUENCY_LIMIT = 50;
+constexpr int HEDGE_LEDGER_SIZE = 8;
+constexpr int RETIRED_ORDER_COUNT = 4;
+
+// The kill switch trips on this many messages, or errors, inside one second. The
+// message threshold leaves enough budget to cancel every live order and hedge.
+constexpr int KILL_MESSAGE_COUNT = MESSAGE_FREQUENCY_LIMIT - ACTIVE_ORDER_COUNT_LIMIT - 2;
+constexpr int KILL_ERROR_COUNT = 5;
+
+// Define RTG_PUBLISH_BROADCAST for the stock trader's target to republish the
+// market data the library decodes into the shared memory ring (broadcast.h) that
+// host.cc reads. One such trader per box; host.cc's target must not define it.
+#ifdef RTG_PUBLISH_BROADCAST
+constexpr bool PUBLISH_BROADCAST = true;
+#else
+constexpr bool PUBLISH_BROADCAST = false;
+#endif
+
+// Runs one strategy composition (see strategy.h) against the exchange. This is
+// the part every strategy shares: the callbacks and journal, the order table and
+// risk gate, the hedge executor and the kill switch. The strategy is asked at
+// each decision, with every call resolved at compile time. Compositions are
+// instantiated in autotrader.cc.
+template<typename Strategy>
+class StrategyTrader : public ReadyTraderGo::BaseAutoTrader
 {
 public:
-    explicit AutoTrader(boost::asio::io_context& context);
+    // Live profit and loss in cents, kept up to date on every fill, status
+    // and book update. Marks are the latest mid price of each instrument.
+    struct PnlState
+    {
+        signed long cash = 0;
+        signed long fees = 0;
+        unsigned long etfMark = 0;
+        unsigned long futMark = 0;
+        signed long pnl = 0;
+        signed long peakPnl = 0;
+        signed long drawdown = 0;
+    };
+
+    // Journals into a file of journalBytes, none if zero. Warm-up locks it into
+    // memory, so several instances in one process want a smaller one.
+    explicit StrategyTrader(boost::asio::io_context& context, std::size_t journalBytes = JOURNAL_BYTES);
+
+    // For tools: sends go to the sink instead of the exchange, and there is no
+    // warm-up or journal file
+    StrategyTrader(boost::asio::io_context& context, SendSink* sendSink);
+
+    const PnlState& Pnl() const { return mPnl; }
+
+    // True once the execution connection has gone, see RunContext in runmode.h
+    bool Finished() const { return mFinished; }
 
     // Called when the execution connection is lost.
     void DisconnectHandler() override;
@@ -98,36 +156,195 @@ public:
                                   const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidPrices,
                                   const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes) override;
 
-
 private:
+    // Drives an instance from a journal, see replaydriver.h
+    template<typename> friend class ReplayDriver;
+
+    // An ETF order that is live as far as we know, i.e. sent and not yet
+    // reported finished. Volume is what may still trade, so orders we are
+    // cancelling keep counting against our limits until the exchange confirms.
+    struct Order
+    {
+        unsigned long id = 0;
+        ReadyTraderGo::Side side = ReadyTraderGo::Side::BUY;
+        unsigned long price = 0;
+        unsigned long volume = 0;
+        bool cancelling = false;
+
+        // Reconciliation: sum of OrderFilled volumes, volume already applied to
+        // our position (from either message type) and cumulative fees. Healed
+        // is volume a status update applied ahead of its fills, at the order
+        // price, whose fills have not arrived yet.
+        unsigned long fillsReported = 0;
+        unsigned long filled = 0;
+        signed long fees = 0;
+        unsigned long healed = 0;
+    };
+
+    // A hedge order we have sent, with what it asked for and what it got
+    struct Hedge
+    {
+        unsigned long id = 0;
+        ReadyTraderGo::Side side = ReadyTraderGo::Side::BUY;
+        unsigned long requested = 0;
+        unsigned long filled = 0;
+        unsigned long notional = 0;
+        unsigned long touch = 0;
+        int retries = 0;
+    };
+
+    void warmUp(boost::asio::io_context& context);
+    SendSink* const mSendSink;
+
+    bool mFinished = false;
     unsigned long mNextMessageId = 1;
     unsigned long mAskId = 0;
     unsigned long mAskPrice = 0;
-    unsigned long mAskVol = 0;
-    unsigned long mAskCancelId = 0;
-    bool mAskInCross = false;
+    unsigned long mDeferredAskPrice = 0;
     unsigned long mBidId = 0;
     unsigned long mBidPrice = 0;
-    unsigned long mBidVol = 0;
-    unsigned long mBidCancelId = 0;
-    bool mBidInCross = false;
+    unsigned long mDeferredBidPrice = 0;
+
+    // Visible ETF depth, quote sizes for the next futures book are based on it
+    unsigned long mEtfAskDepth = 0;
+    unsigned long mEtfBidDepth = 0;
+
+    // Latest futures depth, the futures book arrives before the ETF book each tick
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> mFutAskPrices = {};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> mFutAskVolumes = {};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> mFutBidPrices = {};
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> mFutBidVolumes = {};
 
-    std::unordered_set<unsigned long> mAsks;
-    std::unordered_set<unsigned long> mBids;
+    // FILL_AND_KILL order taking an ETF/future cross, and where to hedge its fills
+    unsigned long mArbOrderId = 0;
+    unsigned long mArbHedgePrice = 0;
+
+    // Allowed ETF price band, the exchange bounds until we have a reference price
+    unsigned long mPriceBandLow;
+    unsigned long mPriceBandHigh;
+
+    // Order table and running totals used by the risk gate
+    std::array<Order, ACTIVE_ORDER_COUNT_LIMIT> mOrders;
+    int mLiveOrderCount = 0;
+
+    // Finished orders still owed fills for healed volume, oldest overwritten first
+    std::array<Order, RETIRED_ORDER_COUNT> mRetiredOrders;
+    int mRetiredIndex = 0;
+    unsigned long mLiveAskVolume = 0;
+    unsigned long mLiveBidVolume = 0;
 
-    unsigned long ticksUnhedged = 0;
     long etfPosition = 0;
     long futPosition = 0;
-    unsigned long mHedgeAskId = 0;
-    unsigned long mHedgeBidId = 0;
-    std::unordered_set<unsigned long> mHedges;
+    PnlState mPnl;
+
+    // Markouts, trade flow and intensity, inline or on their own thread. The
+    // signals are read once per tick before deciding what to quote.
+    Analytics mAnalytics;
+    AnalyticsSignals mSignals;
+
+    // Pricing, sizing, hedging and risk decisions
+    Strategy mStrategy;
+
+    // Hedge ledger, one entry per hedge order until its fill report arrives.
+    // In flight volume is signed, positive for buys.
+    std::array<Hedge, HEDGE_LEDGER_SIZE> mHedgeLedger;
+    long mHedgeInFlight = 0;
+
+    // Hedge deadline on the io_context's monotonic clock, armed while we are over
+    // HEDGE_LIMIT. At most one wait is outstanding on the timer, see waitForHedgeDeadline.
+    boost::asio::steady_timer mHedgeTimer;
+    bool mHedgeTimerArmed = false;
+    bool mHedgeWaitPending = false;
+    std::chrono::steady_clock::time_point mHedgeDeadline;
+    std::chrono::steady_clock::time_point mUnhedgedSince;
+
+    // Reported at disconnect rather than logged as they happen, logging allocates
+    unsigned long mHedgeCount = 0;
+    unsigned long mHedgeRequested = 0;
+    unsigned long mHedgeFilled = 0;
+    signed long mHedgeSlippage = 0;
+    unsigned long mThrottleChanges = 0;
+    unsigned long mUnrecognisedHedges = 0;
+    unsigned long mLedgerFullLots = 0;
+    unsigned long mStatusAheadOfFills = 0;
 
+    // Kill switch, once tripped nothing new is inserted. The time rings hold the
+    // send time of the last KILL_MESSAGE_COUNT messages and the last KILL_ERROR_COUNT
+    // errors, so a rate check is one comparison against the oldest entry.
+    bool mKilled = false;
+    std::array<std::chrono::steady_clock::time_point, KILL_MESSAGE_COUNT> mMessageTimes = {};
+    int mMessageIndex = 0;
+    std::array<std::chrono::steady_clock::time_point, KILL_ERROR_COUNT> mErrorTimes = {};
+    int mErrorIndex = 0;
+
+    // Every inbound callback, recorded before it is handled, and every message
+    // sent. mNow is the journal's stamp for the callback being handled and is
+    // the only clock the trading logic reads, so replays see identical times.
+    Journal mJournal;
+    std::chrono::steady_clock::time_point mNow;
+
+    // Republishes every book and trade ticks update the library decoded for us
+    // into the shared memory ring for host.cc, when PUBLISH_BROADCAST is on
+    std::unique_ptr<BroadcastPublisher> mBroadcast;
+
+    void onOrderStatus(unsigned long clientOrderId, unsigned long fillVolume, unsigned long remainingVolume,
+                       signed long fees);
+
+    template<typename Levels>
+    void takeArbitrage(const Levels& askPrices,
+                       const Levels& askVolumes,
+                       const Levels& bidPrices,
+                       const Levels& bidVolumes);
+    // Hedge executor: prices from the futures depth with a slippage cap and
+    // retries any unfilled residual
+    void hedge(ReadyTraderGo::Side side, unsigned long volume);
+    void sendHedge(ReadyTraderGo::Side side, unsigned long price, unsigned long volume, int retries);
+    Hedge* findHedge(unsigned long clientOrderId);
+    unsigned long hedgePrice(ReadyTraderGo::Side side, unsigned long volume) const;
+    void updateHedgeTimer();
+    void waitForHedgeDeadline();
+    void hedgeTimerExpired();
+    void hedgeDeadlineHandler();
+    void hedgeArbitrageFill(ReadyTraderGo::Side side, unsigned long volume);
 
     void makeAskBasedOnFut(unsigned long futBestAskPrice);
     void makeBidBasedOnFut(unsigned long futBestBidPrice);
+    void updateThrottle();
+    template<typename Levels>
+    void updateQuoteSizes(const Levels& futAskVolumes, const Levels& futBidVolumes);
     unsigned long maxAskVol();
     unsigned long maxBidVol();
 
+    // Self-cross prevention: a quote that would trade with one of our own
+    // resting orders is held back (deferred price is non-zero) until that
+    // order is cancelled and confirmed gone, then sent straight away.
+    void placeAsk(unsigned long price);
+    void placeBid(unsigned long price);
+    void releaseDeferredQuotes();
+    Order* findCross(ReadyTraderGo::Side side, unsigned long price);
+    void cancelOrder(unsigned long clientOrderId);
+
+    // Risk gate: every ETF insert goes through sendInsert, which clips the
+    // volume so that worst-case position (filled plus every live order on
+    // that side trading) stays within the position limit and total live
+    // volume stays within the active volume limit. Returns the new order id,
+    // or zero if nothing could be sent.
+    unsigned long sendInsert(ReadyTraderGo::Side side, unsigned long price, unsigned long volume,
+                             ReadyTraderGo::Lifespan lifespan);
+    unsigned long riskClipVolume(ReadyTraderGo::Side side, unsigned long volume) const;
+    Order* findOrder(unsigned long clientOrderId);
+    void updatePriceBand(unsigned long referencePrice);
+    unsigned long validatePrice(ReadyTraderGo::Side side, unsigned long price) const;
+    void reduceOrder(Order& order, unsigned long newVolume);
+    void applyFill(Order& order, unsigned long price, unsigned long volume);
+    void repriceHealedFill(Order& order, unsigned long price, unsigned long volume);
+    void updatePnl();
+
+    bool countMessage();
+    void tripKillSwitch(const char* reason);
+
 };
 
+using AutoTrader = StrategyTrader<DefaultStrategy>;
+
 #endif //CPPREADY_TRADER_GO_AUTOTRADER_H
\ No newline at end of file
@@ -0,0 +1,267 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_BROADCAST_H
+#define CPPREADY_TRADER_GO_BROADCAST_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <ready_trader_go/types.h>
+
+// Shared memory broadcast ring of decoded book and trade tick updates, written
+// by one trader (see RTG_PUBLISH_BROADCAST in autotrader.h) and read by any
+// number of local trader processes. Records hold the levels as the std::arrays
+// the library handlers take. The ring is not zero-copy: the writer can lap a
+// reader at any time, so a reader copies each record out of its slot, validates
+// the copy, and gives the handlers the copy, never the slot.
+constexpr const char* BROADCAST_NAME = "/ready-trader-go-md";
+constexpr std::uint64_t BROADCAST_SLOTS = 4096;
+constexpr std::uint64_t BROADCAST_MAGIC = 0x5254474f42524431;
+
+struct BroadcastRecord
+{
+    enum class Type : std::uint8_t
+    {
+        ORDER_BOOK,
+        TRADE_TICKS
+    };
+
+    Type type;
+    ReadyTraderGo::Instrument instrument;
+    unsigned long sequenceNumber;
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> askPrices;
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> askVolumes;
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> bidPrices;
+    std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT> bidVolumes;
+};
+
+static_assert(std::is_trivially_copyable<BroadcastRecord>::value, "records are copied while being written");
+
+// Each slot carries its own sequence, seqlock style: 2n + 1 while record n is
+// being written, 2n + 2 once it is complete. A reader expecting record n that
+// finds a later sequence has been lapped by the writer.
+struct alignas(64) BroadcastSlot
+{
+    std::atomic<std::uint64_t> sequence;
+    BroadcastRecord record;
+};
+
+struct alignas(64) BroadcastHeader
+{
+    std::uint64_t magic;
+    std::uint64_t slotCount;
+    std::atomic<std::uint64_t> published;
+};
+
+constexpr std::size_t broadcastSize(std::uint64_t slotCount)
+{
+    return sizeof(BroadcastHeader) + slotCount * sizeof(BroadcastSlot);
+}
+
+// Creates (or takes over) the ring and writes records into it. Never waits for
+// readers, a slow reader finds out it was lapped.
+class BroadcastPublisher
+{
+public:
+    explicit BroadcastPublisher(const std::string& name = BROADCAST_NAME, std::uint64_t slotCount = BROADCAST_SLOTS)
+        : mName(name)
+    {
+        int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0) return;
+
+        mSize = broadcastSize(slotCount);
+        if (::ftruncate(fd, mSize) == 0) {
+            void* data = ::mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED) {
+                mHeader = static_cast<BroadcastHeader*>(data);
+                mSlots = reinterpret_cast<BroadcastSlot*>(mHeader + 1);
+
+                // Restart from zero; readers attached to an older run see the magic
+                // go away, then start again from the new cursor
+                mHeader->magic = 0;
+                mHeader->slotCount = slotCount;
+                mHeader->published.store(0, std::memory_order_relaxed);
+                for (std::uint64_t i = 0; i < slotCount; i++) {
+                    mSlots[i].sequence.store(0, std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_release);
+                mHeader->magic = BROADCAST_MAGIC;
+            }
+        }
+        ::close(fd);
+    }
+
+    // Removes the segment, readers still attached keep their mapping until they detach
+    ~BroadcastPublisher()
+    {
+        if (!mHeader) return;
+        ::munmap(mHeader, mSize);
+        ::shm_unlink(mName.c_str());
+    }
+
+    BroadcastPublisher(const BroadcastPublisher&) = delete;
+    BroadcastPublisher& operator=(const BroadcastPublisher&) = delete;
+
+    bool IsOpen() const { return mHeader != nullptr; }
+
+    // Levels is anything indexable like the library's level arrays
+    template<typename Levels>
+    void Publish(BroadcastRecord::Type type, ReadyTraderGo::Instrument instrument, unsigned long sequenceNumber,
+                 const Levels& askPrices, const Levels& askVolumes, const Levels& bidPrices, const Levels& bidVolumes)
+    {
+        std::uint64_t index = mHeader->published.load(std::memory_order_relaxed);
+        BroadcastSlot& slot = mSlots[index % mHeader->slotCount];
+
+        slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        BroadcastRecord& record = slot.record;
+        record.type = type;
+        record.instrument = instrument;
+        record.sequenceNumber = sequenceNumber;
+        for (int i = 0; i < ReadyTraderGo::TOP_LEVEL_COUNT; i++) {
+            record.askPrices[i] = askPrices[i];
+            record.askVolumes[i] = askVolumes[i];
+            record.bidPrices[i] = bidPrices[i];
+            record.bidVolumes[i] = bidVolumes[i];
+        }
+
+        slot.sequence.store(2 * index + 2, std::memory_order_release);
+        mHeader->published.store(index + 1, std::memory_order_release);
+    }
+
+private:
+    std::string mName;
+    BroadcastHeader* mHeader = nullptr;
+    BroadcastSlot* mSlots = nullptr;
+    std::size_t mSize = 0;
+};
+
+// One reader of the ring with its own cursor, handing each record to the
+// handler's OrderBookMessageHandler / TradeTicksMessageHandler. A record is
+// copied out and only dispatched if its slot was not rewritten meanwhile. A
+// reader that falls more than a ring behind, or whose record was overwritten
+// while it was copying, counts an overrun and skips to the oldest record still
+// in the ring.
+template<typename Handler>
+class BroadcastReader
+{
+public:
+    BroadcastReader(Handler& handler, const std::string& name = BROADCAST_NAME) : mHandler(handler)
+    {
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) return;
+
+        BroadcastHeader header{};
+        if (::pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.magic == BROADCAST_MAGIC) {
+            mSize = broadcastSize(header.slotCount);
+            void* data = ::mmap(nullptr, mSize, PROT_READ, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED) {
+                mHeader = static_cast<const BroadcastHeader*>(data);
+                mSlots = reinterpret_cast<const BroadcastSlot*>(mHeader + 1);
+                mSlotCount = header.slotCount;
+                mCursor = mHeader->published.load(std::memory_order_acquire);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~BroadcastReader()
+    {
+        if (mHeader) ::munmap(const_cast<BroadcastHeader*>(mHeader), mSize);
+    }
+
+    BroadcastReader(const BroadcastReader&) = delete;
+    BroadcastReader& operator=(const BroadcastReader&) = delete;
+
+    bool IsOpen() const { return mHeader != nullptr; }
+    unsigned long Overruns() const { return mOverruns; }
+
+    // Dispatches every record published since the last call, returns how many
+    int Poll()
+    {
+        if (!mHeader) return 0;
+
+        std::uint64_t published = mHeader->published.load(std::memory_order_acquire);
+        if (published < mCursor) {
+            // The publisher restarted
+            mCursor = published;
+        }
+
+        int dispatched = 0;
+        while (mCursor < published) {
+            if (published - mCursor > mSlotCount) {
+                lapped(published);
+                continue;
+            }
+
+            const BroadcastSlot& slot = mSlots[mCursor % mSlotCount];
+            std::uint64_t expected = 2 * mCursor + 2;
+            if (slot.sequence.load(std::memory_order_acquire) != expected) {
+                lapped(published);
+                continue;
+            }
+
+            // The writer may be rewriting the slot, so the handler only ever sees
+            // a copy that is known to be whole
+            BroadcastRecord record = slot.record;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != expected) {
+                lapped(mHeader->published.load(std::memory_order_acquire));
+                continue;
+            }
+
+            mCursor++;
+            dispatched++;
+            if (record.type == BroadcastRecord::Type::ORDER_BOOK) {
+                mHandler.OrderBookMessageHandler(record.instrument, record.sequenceNumber, record.askPrices,
+                                                 record.askVolumes, record.bidPrices, record.bidVolumes);
+            }
+            else {
+                mHandler.TradeTicksMessageHandler(record.instrument, record.sequenceNumber, record.askPrices,
+                                                  record.askVolumes, record.bidPrices, record.bidVolumes);
+            }
+        }
+        return dispatched;
+    }
+
+private:
+    void lapped(std::uint64_t published)
+    {
+        mOverruns++;
+        // Leave a little room so the next record is not the one being overwritten
+        mCursor = published - mSlotCount / 2;
+    }
+
+    Handler& mHandler;
+    const BroadcastHeader* mHeader = nullptr;
+    const BroadcastSlot* mSlots = nullptr;
+    std::uint64_t mSlotCount = 0;
+    std::size_t mSize = 0;
+    std::uint64_t mCursor = 0;
+    unsigned long mOverruns = 0;
+};
+
+#endif //CPPREADY_TRADER_GO_BROADCAST_H
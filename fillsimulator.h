@@ -0,0 +1,281 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+
+#ifndef CPPREADY_TRADER_GO_FILLSIMULATOR_H
+#define CPPREADY_TRADER_GO_FILLSIMULATOR_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <ready_trader_go/types.h>
+
+#include "journal.h"
+#include "sendsink.h"
+
+// Fees from exchange.json
+constexpr double MAKER_FEE = -0.0001;
+constexpr double TAKER_FEE_RATE = 0.0002;
+
+// A simulated exchange for one strategy. It takes the strategy's sends as a
+// SendSink and answers with fills and status updates:
+//  - inserts trade straight away against the last ETF book, at the book's
+//    prices, as a taker; the rest is cancelled (FILL_AND_KILL) or rests
+//  - resting orders fill as a maker, at their own price, against trade ticks
+//    that printed through them, never more than the printed volume
+//  - hedges fill against the last futures book up to their limit price
+// Replies are queued and delivered after the strategy's callback returns,
+// like messages from a real exchange.
+class FillSimulator : public SendSink
+{
+public:
+    using Feed = std::function<void(const JournalRecord&)>;
+
+    explicit FillSimulator(Feed feed) : mFeed(std::move(feed)) {}
+
+    void InsertOrder(unsigned long clientOrderId, ReadyTraderGo::Side side, unsigned long price, unsigned long volume,
+                     ReadyTraderGo::Lifespan lifespan) override
+    {
+        mMessages++;
+        mOrdersSent++;
+        mPending.push_back({JournalType::INSERT_ORDER, clientOrderId, side, price, volume, lifespan});
+    }
+
+    void CancelOrder(unsigned long clientOrderId) override
+    {
+        mMessages++;
+        mPending.push_back({JournalType::CANCEL_ORDER, clientOrderId, ReadyTraderGo::Side::BUY, 0, 0,
+                            ReadyTraderGo::Lifespan::GOOD_FOR_DAY});
+    }
+
+    void HedgeOrder(unsigned long clientOrderId, ReadyTraderGo::Side side, unsigned long price,
+                    unsigned long volume) override
+    {
+        mMessages++;
+        mPending.push_back({JournalType::HEDGE_ORDER, clientOrderId, side, price, volume,
+                            ReadyTraderGo::Lifespan::FILL_AND_KILL});
+    }
+
+    // A recorded market record, before it is given to the strategy
+    void OnMarket(const JournalRecord& record)
+    {
+        mTicks = record.timestamp;
+        ReadyTraderGo::Instrument instrument = static_cast<ReadyTraderGo::Instrument>(record.instrument);
+        if (record.type == JournalType::ORDER_BOOK) {
+            Book& book = (instrument == ReadyTraderGo::Instrument::ETF) ? mEtfBook : mFutBook;
+            for (int side = 0; side < 4; side++) {
+                for (int i = 0; i < ReadyTraderGo::TOP_LEVEL_COUNT; i++) book[side][i] = record.book.levels[side][i];
+            }
+        }
+        else if (record.type == JournalType::TRADE_TICKS && instrument == ReadyTraderGo::Instrument::ETF) {
+            tradeThrough(record);
+        }
+    }
+
+    // Works through the strategy's sends and our replies until both are quiet
+    void Settle()
+    {
+        while (!mPending.empty() || !mReplies.empty()) {
+            while (!mPending.empty()) {
+                Pending message = mPending.front();
+                mPending.pop_front();
+                execute(message);
+            }
+            while (!mReplies.empty()) {
+                JournalRecord reply = mReplies.front();
+                mReplies.pop_front();
+                mFeed(reply);
+            }
+        }
+    }
+
+    unsigned long OrdersSent() const { return mOrdersSent; }
+    unsigned long Messages() const { return mMessages; }
+    long EtfPosition() const { return mEtfPosition; }
+    long FutPosition() const { return mFutPosition; }
+
+    // Cash less fees plus positions marked at the mids, in cents
+    long Pnl() const
+    {
+        return mCash - mFees + mEtfPosition * (long)mid(mEtfBook) + mFutPosition * (long)mid(mFutBook);
+    }
+
+private:
+    using Book = std::array<std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>, 4>;
+
+    struct Pending
+    {
+        JournalType type;
+        unsigned long clientOrderId;
+        ReadyTraderGo::Side side;
+        unsigned long price;
+        unsigned long volume;
+        ReadyTraderGo::Lifespan lifespan;
+    };
+
+    struct Resting
+    {
+        unsigned long clientOrderId;
+        ReadyTraderGo::Side side;
+        unsigned long price;
+        unsigned long remaining;
+        unsigned long filled;
+        long fees;
+    };
+
+    static unsigned long mid(const Book& book)
+    {
+        return (book[0][0] && book[2][0]) ? (book[0][0] + book[2][0]) / 2 : 0;
+    }
+
+    void execute(const Pending& message)
+    {
+        if (message.type == JournalType::INSERT_ORDER) insert(message);
+        else if (message.type == JournalType::CANCEL_ORDER) cancel(message.clientOrderId);
+        else hedge(message);
+    }
+
+    void insert(const Pending& message)
+    {
+        Resting order{message.clientOrderId, message.side, message.price, message.volume, 0, 0};
+
+        // Buys take the asks (levels 0 and 1), sells the bids (levels 2 and 3)
+        bool buy = message.side == ReadyTraderGo::Side::BUY;
+        int prices = buy ? 0 : 2;
+        for (int i = 0; i < ReadyTraderGo::TOP_LEVEL_COUNT && order.remaining; i++) {
+            unsigned long level = mEtfBook[prices][i];
+            if (!level || (buy ? level > message.price : level < message.price)) break;
+            unsigned long volume = std::min(order.remaining, mEtfBook[prices + 1][i]);
+            if (volume) fill(order, level, volume, TAKER_FEE_RATE);
+        }
+
+        if (message.lifespan == ReadyTraderGo::Lifespan::FILL_AND_KILL) order.remaining = 0;
+        status(order);
+        if (order.remaining) mResting.push_back(order);
+    }
+
+    void cancel(unsigned long clientOrderId)
+    {
+        auto it = std::find_if(mResting.begin(), mResting.end(),
+                               [clientOrderId](const Resting& order) { return order.clientOrderId == clientOrderId; });
+        if (it == mResting.end()) return;
+        it->remaining = 0;
+        status(*it);
+        mResting.erase(it);
+    }
+
+    void hedge(const Pending& message)
+    {
+        bool buy = message.side == ReadyTraderGo::Side::BUY;
+        int prices = buy ? 0 : 2;
+        unsigned long remaining = message.volume, filled = 0, notional = 0;
+        for (int i = 0; i < ReadyTraderGo::TOP_LEVEL_COUNT && remaining; i++) {
+            unsigned long level = mFutBook[prices][i];
+            if (!level || (buy ? level > message.price : level < message.price)) break;
+            unsigned long volume = std::min(remaining, mFutBook[prices + 1][i]);
+            filled += volume;
+            notional += volume * level;
+            remaining -= volume;
+        }
+
+        long signedVolume = buy ? (long)filled : -(long)filled;
+        mFutPosition += signedVolume;
+        mCash -= signedVolume ? (buy ? (long)notional : -(long)notional) : 0;
+
+        JournalRecord reply{};
+        reply.timestamp = mTicks;
+        reply.type = JournalType::HEDGE_FILLED;
+        reply.fill = {message.clientOrderId, filled ? (notional + filled / 2) / filled : 0, filled};
+        mReplies.push_back(reply);
+    }
+
+    // Resting orders trade with aggressive flow that printed at or through their price
+    void tradeThrough(const JournalRecord& record)
+    {
+        const auto& levels = record.book.levels;
+        unsigned long bought = 0, sold = 0;
+        for (Resting& order : mResting) {
+            unsigned long printed = 0;
+            for (int i = 0; i < ReadyTraderGo::TOP_LEVEL_COUNT; i++) {
+                if (order.side == ReadyTraderGo::Side::SELL && levels[0][i] && levels[0][i] >= order.price) {
+                    printed += levels[1][i];
+                }
+                if (order.side == ReadyTraderGo::Side::BUY && levels[2][i] && levels[2][i] <= order.price) {
+                    printed += levels[3][i];
+                }
+            }
+            unsigned long& used = (order.side == ReadyTraderGo::Side::SELL) ? bought : sold;
+            unsigned long volume = std::min(order.remaining, printed > used ? printed - used : 0);
+            if (!volume) continue;
+            used += volume;
+            fill(order, order.price, volume, MAKER_FEE);
+            status(order);
+        }
+        mResting.erase(std::remove_if(mResting.begin(), mResting.end(),
+                                      [](const Resting& order) { return !order.remaining; }),
+                       mResting.end());
+    }
+
+    void fill(Resting& order, unsigned long price, unsigned long volume, double feeRate)
+    {
+        long notional = (long)(price * volume);
+        long fee = std::lround(notional * feeRate);
+        order.remaining -= volume;
+        order.filled += volume;
+        order.fees += fee;
+        mFees += fee;
+        mEtfPosition += (order.side == ReadyTraderGo::Side::BUY) ? (long)volume : -(long)volume;
+        mCash += (order.side == ReadyTraderGo::Side::BUY) ? -notional : notional;
+
+        JournalRecord reply{};
+        reply.timestamp = mTicks;
+        reply.type = JournalType::ORDER_FILLED;
+        reply.fill = {order.clientOrderId, price, volume};
+        mReplies.push_back(reply);
+    }
+
+    void status(const Resting& order)
+    {
+        JournalRecord reply{};
+        reply.timestamp = mTicks;
+        reply.type = JournalType::ORDER_STATUS;
+        reply.status = {order.clientOrderId, order.filled, order.remaining, order.fees};
+        mReplies.push_back(reply);
+    }
+
+    Feed mFeed;
+    std::deque<Pending> mPending;
+    std::deque<JournalRecord> mReplies;
+    std::vector<Resting> mResting;
+    Book mEtfBook = {};
+    Book mFutBook = {};
+    std::uint64_t mTicks = 0;
+
+    unsigned long mOrdersSent = 0;
+    unsigned long mMessages = 0;
+    long mEtfPosition = 0;
+    long mFutPosition = 0;
+    long mCash = 0;
+    long mFees = 0;
+};
+
+#endif //CPPREADY_TRADER_GO_FILLSIMULATOR_H
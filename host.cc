@@ -0,0 +1,234 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+
+// Runs several strategy instances in one process for local matches, in place
+// of one binary per team. Each instance logs in on its own execution session.
+// Market data is read once per thread from the shared memory broadcast ring
+// (broadcast.h) and each record is handed to every instance on that thread.
+//
+//   host [host.json]
+//
+// Strategies are listed in the "Strategies" section of the config, each with a
+// registered "Type", a "TeamName" and a "Secret". "JournalMegabytes" sizes an
+// instance's journal, HOST_JOURNAL_MEGABYTES by default and none if 0; every
+// journal is locked in memory at warm-up, so the default is far below the stock
+// trader's. "Threads" spreads them round robin over that many threads, each
+// with its own io_context. "RunMode" is applied to every thread; leave "Core"
+// at -1 when running more than one.
+
+#include <array>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <ready_trader_go/baseautotrader.h>
+#include <ready_trader_go/connectivity.h>
+#include <ready_trader_go/types.h>
+
+#include "autotrader.h"
+#include "broadcast.h"
+#include "runmode.h"
+
+using namespace ReadyTraderGo;
+
+// About 65000 records, a busy match fills it but the start of one is kept
+constexpr std::size_t HOST_JOURNAL_MEGABYTES = 8;
+
+static_assert(!PUBLISH_BROADCAST, "host instances read the broadcast ring, build host without RTG_PUBLISH_BROADCAST");
+
+// A strategy instance and how to tell when it is done
+struct StrategyInstance
+{
+    std::unique_ptr<BaseAutoTrader> trader;
+    std::function<bool()> finished;
+};
+
+using StrategyFactory = std::function<StrategyInstance(boost::asio::io_context&, std::size_t journalBytes)>;
+
+template<typename Trader>
+static StrategyInstance makeInstance(boost::asio::io_context& context, std::size_t journalBytes)
+{
+    auto trader = std::make_unique<Trader>(context, journalBytes);
+    Trader* raw = trader.get();
+    return StrategyInstance{std::move(trader), [raw] { return raw->Finished(); }};
+}
+
+// Strategy types the host can run, by the "Type" name used in the config. Each
+// StrategyTrader composition has to be instantiated in autotrader.cc.
+static const std::map<std::string, StrategyFactory>& strategyRegistry()
+{
+    static const std::map<std::string, StrategyFactory> registry = {
+        {"autotrader", makeInstance<AutoTrader>},
+        {"autotrader-half-room", makeInstance<StrategyTrader<HalfRoomStrategy>>},
+    };
+    return registry;
+}
+
+// Hands each broadcast record to every instance on a thread
+class MarketDataFanout
+{
+public:
+    explicit MarketDataFanout(std::vector<StrategyInstance>& instances) : mInstances(instances) {}
+
+    void OrderBookMessageHandler(Instrument instrument,
+                                 unsigned long sequenceNumber,
+                                 const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
+                                 const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
+                                 const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
+                                 const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+    {
+        for (StrategyInstance& instance : mInstances) {
+            instance.trader->OrderBookMessageHandler(instrument, sequenceNumber,
+                                                     askPrices, askVolumes, bidPrices, bidVolumes);
+        }
+    }
+
+    void TradeTicksMessageHandler(Instrument instrument,
+                                  unsigned long sequenceNumber,
+                                  const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
+                                  const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
+                                  const std::array<unsigned long, TOP_LEVEL_COUNT>& bidPrices,
+                                  const std::array<unsigned long, TOP_LEVEL_COUNT>& bidVolumes)
+    {
+        for (StrategyInstance& instance : mInstances) {
+            instance.trader->TradeTicksMessageHandler(instrument, sequenceNumber,
+                                                      askPrices, askVolumes, bidPrices, bidVolumes);
+        }
+    }
+
+private:
+    std::vector<StrategyInstance>& mInstances;
+};
+
+// The library's launcher is not part of this tree, so startSession rests on
+// three assumptions about its public API. Each is checked here, so building
+// against the real headers fails on the assumption rather than somewhere inside
+// startSession.
+template<typename Trader, typename = void>
+struct HasLoginDetails : std::false_type {};
+template<typename Trader>
+struct HasLoginDetails<Trader, std::void_t<decltype(std::declval<Trader&>().SetLoginDetails(
+    std::declval<std::string>(), std::declval<std::string>()))>> : std::true_type {};
+
+template<typename Trader, typename = void>
+struct HasExecutionConnection : std::false_type {};
+template<typename Trader>
+struct HasExecutionConnection<Trader, std::void_t<decltype(std::declval<Trader&>().SetExecutionConnection(
+    std::declval<std::unique_ptr<Connection>>()))>> : std::true_type {};
+
+static_assert(std::is_constructible<Connection, boost::asio::ip::tcp::socket&&>::value,
+              "startSession assumes a Connection is built from a connected socket");
+static_assert(HasLoginDetails<BaseAutoTrader>::value,
+              "startSession assumes BaseAutoTrader::SetLoginDetails(teamName, secret)");
+static_assert(HasExecutionConnection<BaseAutoTrader>::value,
+              "startSession assumes BaseAutoTrader::SetExecutionConnection(std::unique_ptr<Connection>)");
+
+// Opens one execution session and hands it to the trader with its login
+// details. Market data comes from the broadcast ring, not a library subscriber.
+static void startSession(boost::asio::io_context& context, BaseAutoTrader& trader,
+                         const boost::property_tree::ptree& execution,
+                         const std::string& teamName, const std::string& secret)
+{
+    boost::asio::ip::tcp::socket socket(context);
+    socket.connect({boost::asio::ip::make_address(execution.get<std::string>("Host")),
+                    execution.get<unsigned short>("Port")});
+    socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+    trader.SetLoginDetails(teamName, secret);
+    trader.SetExecutionConnection(std::make_unique<Connection>(std::move(socket)));
+}
+
+// One thread's share of the strategies, with its own context and reader
+static void runThread(const boost::property_tree::ptree& config,
+                      const std::vector<boost::property_tree::ptree>& strategies)
+{
+    boost::asio::io_context context;
+    std::vector<StrategyInstance> instances;
+    instances.reserve(strategies.size());
+
+    for (const boost::property_tree::ptree& strategy : strategies) {
+        std::size_t journalBytes = strategy.get<std::size_t>("JournalMegabytes", HOST_JOURNAL_MEGABYTES) * 1024 * 1024;
+        instances.push_back(strategyRegistry().at(strategy.get<std::string>("Type"))(context, journalBytes));
+        startSession(context, *instances.back().trader, config.get_child("Execution"),
+                     strategy.get<std::string>("TeamName"), strategy.get<std::string>("Secret"));
+    }
+
+    MarketDataFanout fanout(instances);
+    std::string broadcastName = config.get<std::string>("Information.Name", BROADCAST_NAME);
+    BroadcastReader<MarketDataFanout> reader(fanout, broadcastName);
+    if (!reader.IsOpen()) {
+        std::cerr << "could not attach to broadcast ring " << broadcastName << ", is a trader built with RTG_PUBLISH_BROADCAST running?" << std::endl;
+        return;
+    }
+
+    RunContext(context, LoadRunMode(config),
+               [&instances] {
+                   for (const StrategyInstance& instance : instances) {
+                       if (!instance.finished()) return false;
+                   }
+                   return true;
+               },
+               [&reader] { return reader.Poll(); });
+
+    if (reader.Overruns()) {
+        std::cerr << "broadcast ring overruns: " << reader.Overruns() << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    boost::property_tree::ptree config;
+    boost::property_tree::read_json(argc > 1 ? argv[1] : "host.json", config);
+
+    // Reject unknown types before anything connects
+    std::vector<boost::property_tree::ptree> strategies;
+    for (const auto& entry : config.get_child("Strategies")) {
+        std::string type = entry.second.get<std::string>("Type");
+        if (!strategyRegistry().count(type)) {
+            std::cerr << "unknown strategy type " << type << std::endl;
+            return 1;
+        }
+        strategies.push_back(entry.second);
+    }
+
+    std::size_t threadCount = std::max<std::size_t>(1, std::min(config.get<std::size_t>("Threads", 1), strategies.size()));
+    std::vector<std::vector<boost::property_tree::ptree>> shares(threadCount);
+    for (std::size_t i = 0; i < strategies.size(); i++) {
+        shares[i % threadCount].push_back(strategies[i]);
+    }
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(runThread, std::cref(config), std::cref(shares[i]));
+    }
+    runThread(config, shares[0]);
+    for (std::thread& thread : threads) thread.join();
+
+    return 0;
+}
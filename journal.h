@@ -0,0 +1,409 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_JOURNAL_H
+#define CPPREADY_TRADER_GO_JOURNAL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include <ready_trader_go/types.h>
+
+// Binary journal of every inbound callback and every message sent, for
+// replaying a match exactly (see replay.cc).
+// The file is a JournalHeader followed by fixed size JournalRecords, allocated
+// and faulted in up front so that appending is a clock read and a 128 byte
+// store. When the file is full further records are dropped and counted.
+//
+// Records are stamped with the raw cycle counter, which is several times
+// cheaper to read than the steady clock. The header holds a calibration
+// against the steady clock taken when the journal was opened, see
+// JournalReader::Nanoseconds. The trader reads its clock through Stamp() once
+// per callback, so a replay that restores the stamps sees exactly the same times.
+constexpr std::uint64_t JOURNAL_MAGIC = 0x5254474a524e4c31;
+constexpr std::uint32_t JOURNAL_VERSION = 2;
+constexpr std::size_t JOURNAL_BYTES = 64 * 1024 * 1024;
+constexpr std::size_t JOURNAL_MESSAGE_SIZE = 104;
+constexpr std::chrono::milliseconds JOURNAL_CALIBRATION{10};
+
+inline std::uint64_t journalTicks()
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline std::uint64_t steadyNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+enum class JournalType : std::uint8_t
+{
+    NONE,
+    ORDER_BOOK,
+    TRADE_TICKS,
+    ORDER_FILLED,
+    ORDER_STATUS,
+    HEDGE_FILLED,
+    ERROR,
+    DISCONNECT,
+    TIMER,
+
+    // Outbound
+    INSERT_ORDER,
+    CANCEL_ORDER,
+    HEDGE_ORDER
+};
+
+struct JournalRecord
+{
+    // Receive time in cycle counter ticks
+    std::uint64_t timestamp;
+    JournalType type;
+    std::uint8_t instrument;
+    std::uint16_t length;
+    std::uint32_t reserved;
+
+    union
+    {
+        // Order book and trade ticks, levels in the handler's argument order
+        struct
+        {
+            std::uint64_t sequenceNumber;
+            std::uint32_t levels[4][ReadyTraderGo::TOP_LEVEL_COUNT];
+        } book;
+
+        // Order and hedge fills
+        struct
+        {
+            std::uint64_t clientOrderId;
+            std::uint64_t price;
+            std::uint64_t volume;
+        } fill;
+
+        struct
+        {
+            std::uint64_t clientOrderId;
+            std::uint64_t fillVolume;
+            std::uint64_t remainingVolume;
+            std::int64_t fees;
+        } status;
+
+        // Outbound orders, cancels only fill in the id
+        struct
+        {
+            std::uint64_t clientOrderId;
+            std::uint64_t price;
+            std::uint64_t volume;
+            ReadyTraderGo::Side side;
+            ReadyTraderGo::Lifespan lifespan;
+        } order;
+
+        // Message is truncated to fit, length is the stored length
+        struct
+        {
+            std::uint64_t clientOrderId;
+            char message[JOURNAL_MESSAGE_SIZE];
+        } error;
+    };
+};
+
+static_assert(sizeof(JournalRecord) == 128, "journal records are a fixed 128 bytes");
+
+struct alignas(128) JournalHeader
+{
+    std::uint64_t magic;
+    std::uint32_t version;
+    std::uint32_t recordSize;
+    // Steady clock nanoseconds = baseNanoseconds + (ticks - baseTicks) * nanosecondsPerTick
+    std::uint64_t baseTicks;
+    std::uint64_t baseNanoseconds;
+    double nanosecondsPerTick;
+    // Records written so far, updated after each record so a crashed run
+    // leaves a readable journal
+    std::atomic<std::uint64_t> count;
+};
+
+inline std::uint64_t journalNanoseconds(const JournalHeader& header, std::uint64_t ticks)
+{
+    return header.baseNanoseconds
+           + (std::int64_t)((double)(std::int64_t)(ticks - header.baseTicks) * header.nanosecondsPerTick);
+}
+
+// Appends records to a journal file. Does nothing if the file could not be opened.
+class Journal
+{
+public:
+    Journal() = default;
+
+    ~Journal()
+    {
+        if (mHeader) ::munmap(mHeader, mSize);
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    bool Open(const std::string& fileName, std::size_t bytes = JOURNAL_BYTES)
+    {
+        int fd = ::open(fileName.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) return false;
+
+        if (::posix_fallocate(fd, 0, bytes) == 0) {
+            void* data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+            if (data != MAP_FAILED) {
+                // Dirty every page now, a populated shared mapping still faults on first write
+                std::memset(data, 0, bytes);
+                mHeader = static_cast<JournalHeader*>(data);
+                mRecords = reinterpret_cast<JournalRecord*>(mHeader + 1);
+                mSize = bytes;
+                mCapacity = (bytes - sizeof(JournalHeader)) / sizeof(JournalRecord);
+                mHeader->magic = JOURNAL_MAGIC;
+                mHeader->version = JOURNAL_VERSION;
+                mHeader->recordSize = sizeof(JournalRecord);
+                calibrate();
+                mHeader->count.store(0, std::memory_order_release);
+            }
+        }
+        ::close(fd);
+        return mHeader != nullptr;
+    }
+
+    // In memory journal for a replay, stamped with the original run's ticks
+    // (see ReplayTicks) and converted with the original run's calibration
+    bool OpenReplay(const JournalHeader& original, std::size_t bytes = JOURNAL_BYTES)
+    {
+        void* data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) return false;
+
+        mHeader = static_cast<JournalHeader*>(data);
+        mRecords = reinterpret_cast<JournalRecord*>(mHeader + 1);
+        mSize = bytes;
+        mCapacity = (bytes - sizeof(JournalHeader)) / sizeof(JournalRecord);
+        mHeader->magic = JOURNAL_MAGIC;
+        mHeader->version = JOURNAL_VERSION;
+        mHeader->recordSize = sizeof(JournalRecord);
+        mHeader->baseTicks = original.baseTicks;
+        mHeader->baseNanoseconds = original.baseNanoseconds;
+        mHeader->nanosecondsPerTick = original.nanosecondsPerTick;
+        mReplaying = true;
+        return true;
+    }
+
+    bool IsOpen() const { return mHeader != nullptr; }
+    std::uint64_t Dropped() const { return mDropped; }
+    std::uint64_t Count() const { return mCount; }
+    const JournalRecord& operator[](std::uint64_t index) const { return mRecords[index]; }
+    const JournalHeader& Header() const { return *mHeader; }
+
+    // Sets the stamp the next Stamp() call returns when replaying
+    void ReplayTicks(std::uint64_t ticks) { mReplayTicks = ticks; }
+
+    // Called once at the start of every callback. Reads the cycle counter (or
+    // takes the replayed ticks) and returns it as a steady clock time; records
+    // written until the next call carry the same stamp. Without a journal this
+    // is just the steady clock.
+    std::chrono::steady_clock::time_point Stamp()
+    {
+        if (!mHeader) return std::chrono::steady_clock::now();
+        mTicks = mReplaying ? mReplayTicks : journalTicks();
+        return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::nanoseconds(journalNanoseconds(*mHeader, mTicks))));
+    }
+
+    template<typename Levels>
+    void Book(JournalType type, ReadyTraderGo::Instrument instrument, unsigned long sequenceNumber,
+              const Levels& askPrices, const Levels& askVolumes, const Levels& bidPrices, const Levels& bidVolumes)
+    {
+        JournalRecord* record = next(type);
+        if (!record) return;
+        record->instrument = static_cast<std::uint8_t>(instrument);
+        record->book.sequenceNumber = sequenceNumber;
+        for (int i = 0; i < ReadyTraderGo::TOP_LEVEL_COUNT; i++) {
+            record->book.levels[0][i] = askPrices[i];
+            record->book.levels[1][i] = askVolumes[i];
+            record->book.levels[2][i] = bidPrices[i];
+            record->book.levels[3][i] = bidVolumes[i];
+        }
+        commit();
+    }
+
+    void Fill(JournalType type, unsigned long clientOrderId, unsigned long price, unsigned long volume)
+    {
+        JournalRecord* record = next(type);
+        if (!record) return;
+        record->fill = {clientOrderId, price, volume};
+        commit();
+    }
+
+    void Status(unsigned long clientOrderId, unsigned long fillVolume, unsigned long remainingVolume, signed long fees)
+    {
+        JournalRecord* record = next(JournalType::ORDER_STATUS);
+        if (!record) return;
+        record->status = {clientOrderId, fillVolume, remainingVolume, fees};
+        commit();
+    }
+
+    void Error(unsigned long clientOrderId, const std::string& message)
+    {
+        JournalRecord* record = next(JournalType::ERROR);
+        if (!record) return;
+        std::size_t length = std::min(message.size(), JOURNAL_MESSAGE_SIZE);
+        record->length = (std::uint16_t)length;
+        record->error.clientOrderId = clientOrderId;
+        std::memcpy(record->error.message, message.data(), length);
+        commit();
+    }
+
+    void Disconnect()
+    {
+        if (next(JournalType::DISCONNECT)) commit();
+    }
+
+    void Timer()
+    {
+        if (next(JournalType::TIMER)) commit();
+    }
+
+    void Send(JournalType type, unsigned long clientOrderId, ReadyTraderGo::Side side, unsigned long price,
+              unsigned long volume, ReadyTraderGo::Lifespan lifespan)
+    {
+        JournalRecord* record = next(type);
+        if (!record) return;
+        record->order = {clientOrderId, price, volume, side, lifespan};
+        commit();
+    }
+
+private:
+    JournalRecord* next(JournalType type)
+    {
+        if (!mHeader) return nullptr;
+        if (mCount == mCapacity) {
+            mDropped++;
+            return nullptr;
+        }
+
+        JournalRecord* record = &mRecords[mCount];
+        record->timestamp = mTicks;
+        record->type = type;
+        return record;
+    }
+
+    // Spins for JOURNAL_CALIBRATION while the trader is still starting up
+    void calibrate()
+    {
+        std::uint64_t startTicks = journalTicks(), startNanoseconds = steadyNanoseconds();
+        std::uint64_t endNanoseconds;
+        do {
+            endNanoseconds = steadyNanoseconds();
+        } while (endNanoseconds - startNanoseconds < (std::uint64_t)std::chrono::nanoseconds(JOURNAL_CALIBRATION).count());
+        std::uint64_t endTicks = journalTicks();
+
+        mHeader->baseTicks = startTicks;
+        mHeader->baseNanoseconds = startNanoseconds;
+        mHeader->nanosecondsPerTick = (double)(endNanoseconds - startNanoseconds) / (double)(endTicks - startTicks);
+    }
+
+    void commit()
+    {
+        mHeader->count.store(++mCount, std::memory_order_release);
+    }
+
+    JournalHeader* mHeader = nullptr;
+    JournalRecord* mRecords = nullptr;
+    std::size_t mSize = 0;
+    std::uint64_t mCapacity = 0;
+    std::uint64_t mCount = 0;
+    std::uint64_t mDropped = 0;
+    std::uint64_t mTicks = 0;
+    std::uint64_t mReplayTicks = 0;
+    bool mReplaying = false;
+};
+
+// Read only view of a journal file, for tools
+class JournalReader
+{
+public:
+    explicit JournalReader(const std::string& fileName)
+    {
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat info{};
+        if (::fstat(fd, &info) == 0 && (std::size_t)info.st_size >= sizeof(JournalHeader)) {
+            void* data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED) {
+                const JournalHeader* header = static_cast<const JournalHeader*>(data);
+                if (header->magic == JOURNAL_MAGIC && header->version == JOURNAL_VERSION
+                    && header->recordSize == sizeof(JournalRecord)) {
+                    mHeader = header;
+                    mRecords = reinterpret_cast<const JournalRecord*>(header + 1);
+                    mSize = info.st_size;
+                }
+                else {
+                    ::munmap(data, info.st_size);
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    ~JournalReader()
+    {
+        if (mHeader) ::munmap(const_cast<JournalHeader*>(mHeader), mSize);
+    }
+
+    JournalReader(const JournalReader&) = delete;
+    JournalReader& operator=(const JournalReader&) = delete;
+
+    bool IsOpen() const { return mHeader != nullptr; }
+    std::uint64_t Count() const { return mHeader ? mHeader->count.load(std::memory_order_acquire) : 0; }
+    const JournalRecord& operator[](std::uint64_t index) const { return mRecords[index]; }
+
+    const JournalHeader& Header() const { return *mHeader; }
+
+    // A record's timestamp on the recording process's steady clock
+    std::uint64_t Nanoseconds(const JournalRecord& record) const
+    {
+        return journalNanoseconds(*mHeader, record.timestamp);
+    }
+
+private:
+    const JournalHeader* mHeader = nullptr;
+    const JournalRecord* mRecords = nullptr;
+    std::size_t mSize = 0;
+};
+
+#endif //CPPREADY_TRADER_GO_JOURNAL_H
@@ -0,0 +1,60 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_LATENCY_H
+#define CPPREADY_TRADER_GO_LATENCY_H
+
+#include <array>
+#include <cstdint>
+
+// Power-of-two bucketed latency histogram in nanoseconds. Recording is a count
+// leading zeros and an increment, so it is cheap enough for the hot path.
+class LatencyHistogram
+{
+public:
+    static constexpr int BUCKET_COUNT = 64;
+
+    void Record(std::uint64_t nanoseconds)
+    {
+        int bucket = nanoseconds ? 64 - __builtin_clzll(nanoseconds) : 0;
+        mBuckets[bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1]++;
+        mCount++;
+        if (nanoseconds > mMax) mMax = nanoseconds;
+    }
+
+    // Upper bound of the bucket holding the given fraction (0 to 1) of samples
+    std::uint64_t Percentile(double fraction) const
+    {
+        std::uint64_t target = (std::uint64_t)(fraction * mCount);
+        std::uint64_t seen = 0;
+        for (int bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+            seen += mBuckets[bucket];
+            if (seen > target) return bucket ? (std::uint64_t)1 << bucket : 0;
+        }
+        return mMax;
+    }
+
+    std::uint64_t Count() const { return mCount; }
+    std::uint64_t Max() const { return mMax; }
+
+private:
+    std::array<std::uint64_t, BUCKET_COUNT> mBuckets = {};
+    std::uint64_t mCount = 0;
+    std::uint64_t mMax = 0;
+};
+
+#endif //CPPREADY_TRADER_GO_LATENCY_H
@@ -0,0 +1,129 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_MARKOUTS_H
+#define CPPREADY_TRADER_GO_MARKOUTS_H
+
+#include <array>
+
+#include <ready_trader_go/types.h>
+
+constexpr int MARKOUT_HORIZON_COUNT = 3;
+constexpr std::array<unsigned long, MARKOUT_HORIZON_COUNT> MARKOUT_HORIZONS = {1, 4, 20};
+constexpr int MARKOUT_DISTANCE_BUCKETS = 4;
+constexpr unsigned long MARKOUT_RING_SIZE = 64;
+constexpr int MARKOUT_RECENT_HORIZON = 1;
+constexpr double MARKOUT_RECENT_WEIGHT = 0.2;
+
+// Measures how the futures mid moves after each of our fills. A fill is marked
+// out at +1, +4 and +20 ticks (futures book updates) after it happened, in cents
+// per lot, positive when the move went our way. Results are summed per side, per
+// quote distance (ticks from the futures mid at the time of the fill) and per
+// horizon.
+//
+// Pending fills sit in a fixed ring in fill order. Each horizon has its own cursor
+// into the ring, and because a horizon comes due in fill order, each tick only
+// touches entries that are actually due. If fills arrive faster than the ring
+// drains, the oldest fill is dropped along with its outstanding markouts.
+//
+// Recent() gives an exponentially weighted average per side of the markouts at
+// MARKOUT_RECENT_HORIZON, for reacting to what is happening now rather than
+// over the whole match.
+class MarkoutTracker
+{
+public:
+    struct Aggregate
+    {
+        signed long total = 0;
+        unsigned long volume = 0;
+
+        signed long PerLot() const { return volume ? total / (signed long)volume : 0; }
+    };
+
+    void AddFill(ReadyTraderGo::Side side, unsigned long price, unsigned long volume, unsigned long distanceTicks)
+    {
+        if (mTail - mHead == MARKOUT_RING_SIZE) {
+            mHead++;
+            for (unsigned long& cursor : mCursors) {
+                if (cursor < mHead) cursor = mHead;
+            }
+        }
+
+        int bucket = distanceTicks < MARKOUT_DISTANCE_BUCKETS ? (int)distanceTicks : MARKOUT_DISTANCE_BUCKETS - 1;
+        mRing[mTail % MARKOUT_RING_SIZE] = {side, price, volume, bucket, mTick};
+        mTail++;
+    }
+
+    // Call once per futures book update with the new mid price
+    void OnTick(unsigned long midPrice)
+    {
+        mTick++;
+        for (int h = 0; h < MARKOUT_HORIZON_COUNT; h++) {
+            unsigned long& cursor = mCursors[h];
+            while (cursor < mTail && mRing[cursor % MARKOUT_RING_SIZE].tick + MARKOUT_HORIZONS[h] <= mTick) {
+                const Pending& fill = mRing[cursor % MARKOUT_RING_SIZE];
+                signed long move = (signed long)midPrice - (signed long)fill.price;
+                signed long markout = (fill.side == ReadyTraderGo::Side::BUY) ? move : -move;
+
+                Aggregate& aggregate = mAggregates[sideIndex(fill.side)][fill.bucket][h];
+                aggregate.total += markout * (signed long)fill.volume;
+                aggregate.volume += fill.volume;
+                if (h == MARKOUT_RECENT_HORIZON) {
+                    double& recent = mRecent[sideIndex(fill.side)];
+                    recent += (markout - recent) * MARKOUT_RECENT_WEIGHT;
+                }
+                cursor++;
+            }
+        }
+
+        // The longest horizon is always the last to complete
+        mHead = mCursors[MARKOUT_HORIZON_COUNT - 1];
+    }
+
+    const Aggregate& Get(ReadyTraderGo::Side side, int distanceBucket, int horizon) const
+    {
+        return mAggregates[sideIndex(side)][distanceBucket][horizon];
+    }
+
+    double Recent(ReadyTraderGo::Side side) const
+    {
+        return mRecent[sideIndex(side)];
+    }
+
+private:
+    struct Pending
+    {
+        ReadyTraderGo::Side side;
+        unsigned long price;
+        unsigned long volume;
+        int bucket;
+        unsigned long tick;
+    };
+
+    static int sideIndex(ReadyTraderGo::Side side) { return side == ReadyTraderGo::Side::BUY ? 1 : 0; }
+
+    std::array<Pending, MARKOUT_RING_SIZE> mRing = {};
+    unsigned long mHead = 0;
+    unsigned long mTail = 0;
+    std::array<unsigned long, MARKOUT_HORIZON_COUNT> mCursors = {};
+    unsigned long mTick = 0;
+
+    Aggregate mAggregates[2][MARKOUT_DISTANCE_BUCKETS][MARKOUT_HORIZON_COUNT] = {};
+    double mRecent[2] = {};
+};
+
+#endif //CPPREADY_TRADER_GO_MARKOUTS_H
@@ -21,7 +21,7 @@
 
 #include <ready_trader_go/logging.h>
 
-#include "autotrader.h"
+#include "og-trader-cpy.h"
 
 using namespace ReadyTraderGo;
 
@@ -33,17 +33,18 @@ constexpr int TICK_SIZE_IN_CENTS = 100;
 constexpr int MIN_BID_NEARST_TICK = (MINIMUM_BID + TICK_SIZE_IN_CENTS) / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
 constexpr int MAX_ASK_NEAREST_TICK = MAXIMUM_ASK / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
 
-AutoTrader::AutoTrader(boost::asio::io_context& context) : BaseAutoTrader(context)
+OgAutoTrader::OgAutoTrader(boost::asio::io_context& context, SendSink* sendSink) : BaseAutoTrader(context),
+                                                                                   mSendSink(sendSink)
 {
 }
 
-void AutoTrader::DisconnectHandler()
+void OgAutoTrader::DisconnectHandler()
 {
     BaseAutoTrader::DisconnectHandler();
     RLOG(LG_AT, LogLevel::LL_INFO) << "execution connection lost";
 }
 
-void AutoTrader::ErrorMessageHandler(unsigned long clientOrderId,
+void OgAutoTrader::ErrorMessageHandler(unsigned long clientOrderId,
                                      const std::string& errorMessage)
 {
     RLOG(LG_AT, LogLevel::LL_INFO) << "error with order " << clientOrderId << ": " << errorMessage;
@@ -53,7 +54,7 @@ void AutoTrader::ErrorMessageHandler(unsigned long clientOrderId,
     }
 }
 
-void AutoTrader::HedgeFilledMessageHandler(unsigned long clientOrderId,
+void OgAutoTrader::HedgeFilledMessageHandler(unsigned long clientOrderId,
                                            unsigned long price,
                                            unsigned long volume)
 {
@@ -61,7 +62,7 @@ void AutoTrader::HedgeFilledMessageHandler(unsigned long clientOrderId,
                                    << " lots at $" << price << " average price in cents";
 }
 
-void AutoTrader::OrderBookMessageHandler(Instrument instrument,
+void OgAutoTrader::OrderBookMessageHandler(Instrument instrument,
                                          unsigned long sequenceNumber,
                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
                                          const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
@@ -82,12 +83,12 @@ void AutoTrader::OrderBookMessageHandler(Instrument instrument,
 
         if (mAskId != 0 && newAskPrice != 0 && newAskPrice != mAskPrice)
         {
-            SendCancelOrder(mAskId);
+            cancelOrder(mAskId);
             mAskId = 0;
         }
         if (mBidId != 0 && newBidPrice != 0 && newBidPrice != mBidPrice)
         {
-            SendCancelOrder(mBidId);
+            cancelOrder(mBidId);
             mBidId = 0;
         }
 
@@ -95,21 +96,21 @@ void AutoTrader::OrderBookMessageHandler(Instrument instrument,
         {
             mAskId = mNextMessageId++;
             mAskPrice = newAskPrice;
-            SendInsertOrder(mAskId, Side::SELL, newAskPrice, LOT_SIZE, Lifespan::GOOD_FOR_DAY);
+            insertOrder(mAskId, Side::SELL, newAskPrice, LOT_SIZE, Lifespan::GOOD_FOR_DAY);
             mAsks.emplace(mAskId);
         }
         if (mBidId == 0 && newBidPrice != 0 && mPosition < POSITION_LIMIT)
         {
             mBidId = mNextMessageId++;
             mBidPrice = newBidPrice;
-            SendInsertOrder(mBidId, Side::BUY, newBidPrice, LOT_SIZE, Lifespan::GOOD_FOR_DAY);
+            insertOrder(mBidId, Side::BUY, newBidPrice, LOT_SIZE, Lifespan::GOOD_FOR_DAY);
             mBids.emplace(mBidId);
         }
     }
 }
 
 // Log, update positions and hedge after a successful order
-void AutoTrader::OrderFilledMessageHandler(unsigned long clientOrderId,
+void OgAutoTrader::OrderFilledMessageHandler(unsigned long clientOrderId,
                                            unsigned long price,
                                            unsigned long volume)
 {
@@ -118,17 +119,17 @@ void AutoTrader::OrderFilledMessageHandler(unsigned long clientOrderId,
     if (mAsks.count(clientOrderId) == 1)
     {
         mPosition -= (long)volume;
-        SendHedgeOrder(mNextMessageId++, Side::BUY, MAX_ASK_NEAREST_TICK, volume);
+        hedgeOrder(mNextMessageId++, Side::BUY, MAX_ASK_NEAREST_TICK, volume);
     }
     else if (mBids.count(clientOrderId) == 1)
     {
         mPosition += (long)volume;
-        SendHedgeOrder(mNextMessageId++, Side::SELL, MIN_BID_NEARST_TICK, volume);
+        hedgeOrder(mNextMessageId++, Side::SELL, MIN_BID_NEARST_TICK, volume);
     }
 }
 
 // Handle changes to order status by changing last bid/ask id
-void AutoTrader::OrderStatusMessageHandler(unsigned long clientOrderId,
+void OgAutoTrader::OrderStatusMessageHandler(unsigned long clientOrderId,
                                            unsigned long fillVolume,
                                            unsigned long remainingVolume,
                                            signed long fees)
@@ -153,7 +154,7 @@ void AutoTrader::OrderStatusMessageHandler(unsigned long clientOrderId,
 }
 
 // Log info about most recent tick
-void AutoTrader::TradeTicksMessageHandler(Instrument instrument,
+void OgAutoTrader::TradeTicksMessageHandler(Instrument instrument,
                                           unsigned long sequenceNumber,
                                           const std::array<unsigned long, TOP_LEVEL_COUNT>& askPrices,
                                           const std::array<unsigned long, TOP_LEVEL_COUNT>& askVolumes,
@@ -167,3 +168,22 @@ void AutoTrader::TradeTicksMessageHandler(Instrument instrument,
                                    << "; bid prices: " << bidPrices[0]
                                    << "; bid volumes: " << bidVolumes[0];
 }
+
+void OgAutoTrader::insertOrder(unsigned long clientOrderId, Side side, unsigned long price,
+                               unsigned long volume, Lifespan lifespan)
+{
+    if (mSendSink) mSendSink->InsertOrder(clientOrderId, side, price, volume, lifespan);
+    else SendInsertOrder(clientOrderId, side, price, volume, lifespan);
+}
+
+void OgAutoTrader::cancelOrder(unsigned long clientOrderId)
+{
+    if (mSendSink) mSendSink->CancelOrder(clientOrderId);
+    else SendCancelOrder(clientOrderId);
+}
+
+void OgAutoTrader::hedgeOrder(unsigned long clientOrderId, Side side, unsigned long price, unsigned long volume)
+{
+    if (mSendSink) mSendSink->HedgeOrder(clientOrderId, side, price, volume);
+    else SendHedgeOrder(clientOrderId, side, price, volume);
+}
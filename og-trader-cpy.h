@@ -15,8 +15,8 @@
 //     You should have received a copy of the GNU Affero General Public
 //     License along with Ready Trader Go.  If not, see
 //     <https://www.gnu.org/licenses/>.
-#ifndef CPPREADY_TRADER_GO_AUTOTRADER_H
-#define CPPREADY_TRADER_GO_AUTOTRADER_H
+#ifndef CPPREADY_TRADER_GO_OG_TRADER_CPY_H
+#define CPPREADY_TRADER_GO_OG_TRADER_CPY_H
 
 #include <array>
 #include <memory>
@@ -28,10 +28,14 @@
 #include <ready_trader_go/baseautotrader.h>
 #include <ready_trader_go/types.h>
 
-class AutoTrader : public ReadyTraderGo::BaseAutoTrader
+#include "sendsink.h"
+
+// The original strategy, kept as a baseline to compare autotrader against (see abtest.cc)
+class OgAutoTrader : public ReadyTraderGo::BaseAutoTrader
 {
 public:
-    explicit AutoTrader(boost::asio::io_context& context);
+    // With a sink, sends go there instead of the exchange
+    explicit OgAutoTrader(boost::asio::io_context& context, SendSink* sendSink = nullptr);
 
     // Called when the execution connection is lost.
     void DisconnectHandler() override;
@@ -94,6 +98,13 @@ public:
                                   const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& bidVolumes) override;
 
 private:
+    void insertOrder(unsigned long clientOrderId, ReadyTraderGo::Side side, unsigned long price,
+                     unsigned long volume, ReadyTraderGo::Lifespan lifespan);
+    void cancelOrder(unsigned long clientOrderId);
+    void hedgeOrder(unsigned long clientOrderId, ReadyTraderGo::Side side, unsigned long price,
+                    unsigned long volume);
+
+    SendSink* mSendSink;
     unsigned long mNextMessageId = 1;
     unsigned long mAskId = 0;
     unsigned long mAskPrice = 0;
@@ -104,4 +115,4 @@ private:
     std::unordered_set<unsigned long> mBids;
 };
 
-#endif //CPPREADY_TRADER_GO_AUTOTRADER_H
+#endif //CPPREADY_TRADER_GO_OG_TRADER_CPY_H
@@ -0,0 +1,514 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+
+// Replays a journal recorded by AutoTrader (see journal.h) through a fresh
+// AutoTrader and diffs everything it sends against what the original run sent.
+//
+//   replay [--check-allocations[=events]] <journal> [differences to print]
+//   replay --self-test[=ticks]
+//
+// The replayed trader gets every inbound callback and hedge timer expiry in the
+// original order, with the original stamps, so the same code makes the same
+// decisions and its journal matches the original record for record. After a
+// strategy change the differences show exactly where and how decisions moved.
+// Exits with 1 if anything differs. Replays are only exact with the analytics
+// inline (USE_ANALYTICS_THREAD false), since the thread's timing is not recorded.
+//
+// --check-allocations checks that the trader's handlers never touch the heap
+// once it is warm: after the first ALLOCATION_WARM_UP_EVENTS events (or as many
+// as given) any operator new aborts the replay with a stack trace of the offending
+// call. Build with -rdynamic to get function names in the trace. Only trading is
+// checked: the disconnect report and the kill switch log through the library,
+// which allocates, so the DISCONNECT record, the event that trips the kill switch
+// and everything after it are not.
+//
+// --self-test is the allocation test and needs no journal: it runs a made-up
+// market through AutoTrader against FillSimulator, abtest's simulated exchange,
+// with the check on for everything the trader handles. Exits with 1 if the
+// kill switch stopped trading, which would leave the check proving nothing.
+// It then trips the kill switch on a quoting trader, fills a quote that is
+// being cancelled and exits with 1 unless that fill is hedged.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+
+#include <execinfo.h>
+#include <unistd.h>
+
+#include "fillsimulator.h"
+#include "journal.h"
+#include "replaydriver.h"
+#include "sendsink.h"
+
+using namespace ReadyTraderGo;
+
+constexpr std::uint64_t ALLOCATION_WARM_UP_EVENTS = 1000;
+constexpr int ALLOCATION_TRACE_DEPTH = 64;
+constexpr std::uint64_t SELF_TEST_TICKS = 20000;
+constexpr std::uint64_t SELF_TEST_TICK_NANOSECONDS = 250000000;
+constexpr std::uint64_t SELF_TEST_ERROR_INTERVAL = 1500;
+constexpr std::uint64_t UNHEDGED_TIME_LIMIT_NANOSECONDS = 60000000000;
+
+// Set while the trader is handling events that must not allocate
+static bool allocationsForbidden = false;
+
+// The first allocation of the current event, reported by checkedEventDone.
+// Nothing in here may allocate, the heap is what we are reporting on.
+static std::size_t allocationSize = 0;
+static void* allocationFrames[ALLOCATION_TRACE_DEPTH];
+static int allocationFrameCount = 0;
+
+static void allocationFailure(std::size_t size)
+{
+    allocationsForbidden = false;
+    allocationSize = size;
+    allocationFrameCount = backtrace(allocationFrames, ALLOCATION_TRACE_DEPTH);
+}
+
+// Ends a checked event. An event that tripped the kill switch logged it, so
+// its allocations are dropped and the caller stops checking.
+static void checkedEventDone(bool tripped)
+{
+    allocationsForbidden = false;
+    if (!allocationFrameCount || tripped) {
+        allocationFrameCount = 0;
+        return;
+    }
+    char message[96];
+    int length = std::snprintf(message, sizeof(message), "heap allocation of %zu bytes after warm-up:\n",
+                               allocationSize);
+    ::write(STDERR_FILENO, message, length);
+    backtrace_symbols_fd(allocationFrames, allocationFrameCount, STDERR_FILENO);
+    std::abort();
+}
+
+// Every allocation in the process comes through here. Out of line, so the compiler
+// does not see the malloc and free behind new and delete and warn of a mismatch.
+[[gnu::noinline]] void* operator new(std::size_t size)
+{
+    if (allocationsForbidden) allocationFailure(size);
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    if (allocationsForbidden) allocationFailure(size);
+    return std::malloc(size ? size : 1);
+}
+
+[[gnu::noinline]] void operator delete(void* memory) noexcept { std::free(memory); }
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+[[gnu::noinline]] void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+
+// Lets the simulated exchange's own bookkeeping allocate while it takes the
+// trader's sends, only the trader is under test
+class AllocationExemptSink : public SendSink
+{
+public:
+    explicit AllocationExemptSink(SendSink& sink) : mSink(sink) {}
+
+    void InsertOrder(unsigned long clientOrderId, Side side, unsigned long price, unsigned long volume,
+                     Lifespan lifespan) override
+    {
+        bool forbidden = allocationsForbidden;
+        allocationsForbidden = false;
+        mSink.InsertOrder(clientOrderId, side, price, volume, lifespan);
+        allocationsForbidden = forbidden;
+    }
+
+    void CancelOrder(unsigned long clientOrderId) override
+    {
+        bool forbidden = allocationsForbidden;
+        allocationsForbidden = false;
+        mSink.CancelOrder(clientOrderId);
+        allocationsForbidden = forbidden;
+    }
+
+    void HedgeOrder(unsigned long clientOrderId, Side side, unsigned long price, unsigned long volume) override
+    {
+        bool forbidden = allocationsForbidden;
+        allocationsForbidden = false;
+        mSink.HedgeOrder(clientOrderId, side, price, volume);
+        allocationsForbidden = forbidden;
+    }
+
+private:
+    SendSink& mSink;
+};
+
+// One tick of a made-up market: the future swings around 200000 and steps
+// between levels, and every eleventh tick the ETF crosses it. The ETF trades
+// through its own book, so quoting, arbitrage, fills and hedges all run.
+static void syntheticTick(std::uint64_t tick, std::array<JournalRecord, 3>& records)
+{
+    long offset = std::abs((long)(tick % 40) - 20) - 10;
+    unsigned long mid = 200000 + offset * 100 + ((tick / 500) % 5) * 300;
+    long skew = (tick % 11) ? 0 : (tick % 22) ? -300 : 300;
+    std::uint64_t timestamp = (tick + 1) * SELF_TEST_TICK_NANOSECONDS;
+
+    for (std::size_t r = 0; r < records.size(); r++) {
+        JournalRecord& record = records[r];
+        record = {};
+        record.timestamp = timestamp + r * 1000;
+        record.type = (r == 2) ? JournalType::TRADE_TICKS : JournalType::ORDER_BOOK;
+        record.instrument = static_cast<std::uint8_t>(r ? Instrument::ETF : Instrument::FUTURE);
+        record.book.sequenceNumber = tick + 1;
+        for (int i = 0; i < TOP_LEVEL_COUNT; i++) {
+            long shift = r ? skew : 0;
+            record.book.levels[0][i] = mid + (i + 1) * 100 + shift;
+            record.book.levels[2][i] = mid - (i + 1) * 100 + shift;
+            record.book.levels[1][i] = (r == 2) ? tick % 5 : 20 + 10 * i + tick % 7;
+            record.book.levels[3][i] = (r == 2) ? tick % 3 : 20 + 10 * i + tick % 7;
+        }
+    }
+}
+
+// Runs the synthetic market through the trader like abtest runs a journal,
+// returns the exit code
+static int selfTest(std::uint64_t ticks, std::uint64_t warmUpEvents)
+{
+    // Ticks are nanoseconds on a steady clock an hour after boot, the trader's
+    // rate windows start out at the clock's epoch
+    JournalHeader header{};
+    header.baseNanoseconds = 3600000000000;
+    header.nanosecondsPerTick = 1.0;
+    boost::asio::io_context context;
+
+    std::uint64_t events = 0;
+    ReplayDriver<>* driver = nullptr;
+    auto feed = [&](const JournalRecord& record) {
+        bool killed = driver->Killed();
+        allocationsForbidden = events++ >= warmUpEvents && !killed;
+        driver->Feed(record);
+        checkedEventDone(driver->Killed() != killed);
+    };
+    FillSimulator exchange(feed);
+    AllocationExemptSink sink(exchange);
+    ReplayDriver<> selfTestDriver(context, header, &sink);
+    driver = &selfTestDriver;
+
+    std::array<JournalRecord, 3> records;
+    auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t tick = 0; tick < ticks; tick++) {
+        syntheticTick(tick, records);
+        for (const JournalRecord& record : records) {
+            exchange.OnMarket(record);
+            exchange.Settle();
+            bool killed = driver->Killed();
+            allocationsForbidden = events >= warmUpEvents && !killed;
+            driver->FireDueTimer(record.timestamp);
+            checkedEventDone(driver->Killed() != killed);
+            feed(record);
+            exchange.Settle();
+        }
+
+        // Rejections carry a message, fed like the library's
+        if (tick % SELF_TEST_ERROR_INTERVAL == 0) {
+            JournalRecord error{};
+            error.timestamp = records.back().timestamp + 1000;
+            error.type = JournalType::ERROR;
+            std::snprintf(error.error.message, sizeof(error.error.message), "synthetic rejection of a message");
+            error.length = std::strlen(error.error.message);
+            feed(error);
+            exchange.Settle();
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "no heap allocations after the first " << std::min(warmUpEvents, events) << " events\n"
+              << "self test ran " << events << " events in " << elapsed << "s, " << exchange.OrdersSent()
+              << " orders sent, etf " << exchange.EtfPosition() << " fut " << exchange.FutPosition()
+              << " pnl " << exchange.Pnl() << std::endl;
+    if (driver->Killed()) {
+        std::cout << "kill switch tripped, the check did not cover the whole run" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+static const char* typeName(JournalType type)
+{
+    switch (type) {
+    case JournalType::ORDER_BOOK: return "ORDER_BOOK";
+    case JournalType::TRADE_TICKS: return "TRADE_TICKS";
+    case JournalType::ORDER_FILLED: return "ORDER_FILLED";
+    case JournalType::ORDER_STATUS: return "ORDER_STATUS";
+    case JournalType::HEDGE_FILLED: return "HEDGE_FILLED";
+    case JournalType::ERROR: return "ERROR";
+    case JournalType::DISCONNECT: return "DISCONNECT";
+    case JournalType::TIMER: return "TIMER";
+    case JournalType::INSERT_ORDER: return "INSERT_ORDER";
+    case JournalType::CANCEL_ORDER: return "CANCEL_ORDER";
+    case JournalType::HEDGE_ORDER: return "HEDGE_ORDER";
+    default: return "NONE";
+    }
+}
+
+// Compares the fields each record type uses, never the bytes of the union or
+// the padding, which the journal does not clear
+static bool sameRecord(const JournalRecord& a, const JournalRecord& b)
+{
+    if (a.timestamp != b.timestamp || a.type != b.type) return false;
+
+    switch (a.type) {
+    case JournalType::ORDER_BOOK:
+    case JournalType::TRADE_TICKS:
+        return a.instrument == b.instrument && a.book.sequenceNumber == b.book.sequenceNumber
+               && std::equal(&a.book.levels[0][0], &a.book.levels[0][0] + 4 * TOP_LEVEL_COUNT, &b.book.levels[0][0]);
+    case JournalType::ORDER_FILLED:
+    case JournalType::HEDGE_FILLED:
+        return a.fill.clientOrderId == b.fill.clientOrderId && a.fill.price == b.fill.price
+               && a.fill.volume == b.fill.volume;
+    case JournalType::ORDER_STATUS:
+        return a.status.clientOrderId == b.status.clientOrderId && a.status.fillVolume == b.status.fillVolume
+               && a.status.remainingVolume == b.status.remainingVolume && a.status.fees == b.status.fees;
+    case JournalType::ERROR:
+        return a.error.clientOrderId == b.error.clientOrderId && a.length == b.length
+               && std::memcmp(a.error.message, b.error.message, a.length) == 0;
+    case JournalType::INSERT_ORDER:
+    case JournalType::HEDGE_ORDER:
+        return a.order.clientOrderId == b.order.clientOrderId && a.order.price == b.order.price
+               && a.order.volume == b.order.volume && a.order.side == b.order.side
+               && a.order.lifespan == b.order.lifespan;
+    case JournalType::CANCEL_ORDER:
+        return a.order.clientOrderId == b.order.clientOrderId;
+    default:
+        return true;
+    }
+}
+
+static void describe(std::ostream& out, const JournalRecord& record)
+{
+    out << typeName(record.type);
+    switch (record.type) {
+    case JournalType::ORDER_BOOK:
+    case JournalType::TRADE_TICKS:
+        out << " instrument " << (int)record.instrument << " seq " << record.book.sequenceNumber
+            << " ask " << record.book.levels[0][0] << "x" << record.book.levels[1][0]
+            << " bid " << record.book.levels[2][0] << "x" << record.book.levels[3][0];
+        break;
+    case JournalType::ORDER_FILLED:
+    case JournalType::HEDGE_FILLED:
+        out << " id " << record.fill.clientOrderId << " price " << record.fill.price << " volume " << record.fill.volume;
+        break;
+    case JournalType::ORDER_STATUS:
+        out << " id " << record.status.clientOrderId << " filled " << record.status.fillVolume
+            << " remaining " << record.status.remainingVolume << " fees " << record.status.fees;
+        break;
+    case JournalType::ERROR:
+        out << " id " << record.error.clientOrderId << " " << std::string(record.error.message, record.length);
+        break;
+    case JournalType::INSERT_ORDER:
+    case JournalType::CANCEL_ORDER:
+    case JournalType::HEDGE_ORDER:
+        out << " id " << record.order.clientOrderId << (record.order.side == Side::BUY ? " BUY " : " SELL ")
+            << record.order.volume << "@" << record.order.price;
+        break;
+    default:
+        break;
+    }
+}
+
+// Remembers what the trader sent
+class RecordingSink : public SendSink
+{
+public:
+    struct Message
+    {
+        unsigned long clientOrderId;
+        Side side;
+        unsigned long price;
+        unsigned long volume;
+        Lifespan lifespan;
+    };
+
+    void InsertOrder(unsigned long clientOrderId, Side side, unsigned long price, unsigned long volume,
+                     Lifespan lifespan) override
+    {
+        inserts.push_back({clientOrderId, side, price, volume, lifespan});
+    }
+
+    void CancelOrder(unsigned long clientOrderId) override { cancels.push_back(clientOrderId); }
+
+    void HedgeOrder(unsigned long clientOrderId, Side side, unsigned long price, unsigned long volume) override
+    {
+        hedges.push_back({clientOrderId, side, price, volume, Lifespan::FILL_AND_KILL});
+    }
+
+    std::vector<Message> inserts;
+    std::vector<unsigned long> cancels;
+    std::vector<Message> hedges;
+};
+
+// A quote the kill switch is cancelling can still fill. The trader must keep
+// hedging after the kill, or the fill sits unhedged until the exchange's limit.
+// Returns the exit code.
+static int hedgeAfterKillTest()
+{
+    JournalHeader header{};
+    header.baseNanoseconds = 3600000000000;
+    header.nanosecondsPerTick = 1.0;
+    boost::asio::io_context context;
+    RecordingSink sink;
+    ReplayDriver<> driver(context, header, &sink);
+
+    std::array<JournalRecord, 3> records;
+    for (std::uint64_t tick = 1; tick < 4; tick++) {
+        syntheticTick(tick, records);
+        for (const JournalRecord& record : records) driver.Feed(record);
+    }
+    auto quote = std::find_if(sink.inserts.begin(), sink.inserts.end(), [](const RecordingSink::Message& message) {
+        return message.lifespan == Lifespan::GOOD_FOR_DAY;
+    });
+    if (quote == sink.inserts.end()) {
+        std::cout << "hedge after kill: the trader never quoted" << std::endl;
+        return 1;
+    }
+
+    std::uint64_t now = records.back().timestamp;
+    JournalRecord record{};
+    record.type = JournalType::ERROR;
+    for (int i = 0; i <= KILL_ERROR_COUNT; i++) {
+        record.timestamp = ++now;
+        driver.Feed(record);
+    }
+    if (!driver.Killed() || std::find(sink.cancels.begin(), sink.cancels.end(), quote->clientOrderId) == sink.cancels.end()) {
+        std::cout << "hedge after kill: the error rate did not kill the trader and cancel its quote" << std::endl;
+        return 1;
+    }
+
+    // The whole quote fills before the cancel lands
+    std::size_t hedgesBefore = sink.hedges.size();
+    record = {};
+    record.timestamp = ++now;
+    record.type = JournalType::ORDER_FILLED;
+    record.fill = {quote->clientOrderId, quote->price, quote->volume};
+    driver.Feed(record);
+    record = {};
+    record.timestamp = ++now;
+    record.type = JournalType::ORDER_STATUS;
+    record.status = {quote->clientOrderId, quote->volume, 0, 0};
+    driver.Feed(record);
+
+    std::uint64_t filled = now;
+    for (; now < filled + UNHEDGED_TIME_LIMIT_NANOSECONDS && sink.hedges.size() == hedgesBefore; now += 100000000) {
+        driver.FireDueTimer(now);
+    }
+    Side hedgeSide = (quote->side == Side::BUY) ? Side::SELL : Side::BUY;
+    if (sink.hedges.size() == hedgesBefore || sink.hedges.back().side != hedgeSide
+        || sink.hedges.back().volume != quote->volume) {
+        std::cout << "hedge after kill: a fill of " << quote->volume << " lots after the kill was not hedged"
+                  << std::endl;
+        return 1;
+    }
+    std::cout << "hedge after kill: " << quote->volume << " lots filled after the kill hedged after "
+              << (now - filled) / 1000000000.0 << "s" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    bool checkAllocations = false;
+    std::uint64_t warmUpEvents = ALLOCATION_WARM_UP_EVENTS;
+    int arg = 1;
+
+    // The first backtrace loads the unwinder, which allocates
+    void* frame;
+    backtrace(&frame, 1);
+
+    if (arg < argc && std::strncmp(argv[arg], "--self-test", 11) == 0) {
+        int result = selfTest(argv[arg][11] == '=' ? std::stoull(argv[arg] + 12) : SELF_TEST_TICKS, warmUpEvents);
+        return result ? result : hedgeAfterKillTest();
+    }
+    if (arg < argc && std::strncmp(argv[arg], "--check-allocations", 19) == 0) {
+        checkAllocations = true;
+        if (argv[arg][19] == '=') warmUpEvents = std::stoull(argv[arg] + 20);
+        arg++;
+    }
+
+    if (arg >= argc) {
+        std::cerr << "usage: replay [--check-allocations[=events]] <journal> [differences to print]\n"
+                  << "       replay --self-test[=ticks]" << std::endl;
+        return 2;
+    }
+
+    JournalReader original(argv[arg]);
+    if (!original.IsOpen()) {
+        std::cerr << "could not read journal " << argv[arg] << std::endl;
+        return 2;
+    }
+    unsigned long printLimit = arg + 1 < argc ? std::stoul(argv[arg + 1]) : 10;
+
+    boost::asio::io_context context;
+    ReplayDriver<> driver(context, original.Header());
+
+    std::uint64_t inbound = 0;
+    std::uint64_t checked = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t i = 0; i < original.Count(); i++) {
+        if (isInbound(original[i].type)) {
+            bool killed = driver.Killed();
+            allocationsForbidden = checkAllocations && inbound >= warmUpEvents && !killed
+                                   && original[i].type != JournalType::DISCONNECT;
+            checked += allocationsForbidden;
+            driver.Feed(original[i]);
+            checkedEventDone(driver.Killed() != killed);
+            inbound++;
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Inbound records line up by construction, so the first difference is the
+    // first decision that changed
+    const Journal& replayed = driver.Output();
+    std::uint64_t common = std::min(original.Count(), replayed.Count());
+    unsigned long differences = 0;
+    for (std::uint64_t i = 0; i < common; i++) {
+        if (sameRecord(original[i], replayed[i])) continue;
+        if (differences++ < printLimit) {
+            std::cout << "record " << i << "\n  original: ";
+            describe(std::cout, original[i]);
+            std::cout << "\n  replayed: ";
+            describe(std::cout, replayed[i]);
+            std::cout << "\n";
+        }
+    }
+    if (original.Count() != replayed.Count()) {
+        std::cout << "record counts differ, original " << original.Count() << " replayed " << replayed.Count() << "\n";
+        differences++;
+    }
+
+    if (checkAllocations) {
+        std::cout << "no heap allocations in the " << checked << " trading events after the first "
+                  << std::min(warmUpEvents, inbound) << "\n";
+    }
+    std::cout << "replayed " << inbound << " events in " << elapsed << "s (" << (elapsed > 0 ? inbound / elapsed : 0)
+              << " events/s), " << common << " records compared, " << differences << " differences" << std::endl;
+    return differences ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_REPLAYDRIVER_H
+#define CPPREADY_TRADER_GO_REPLAYDRIVER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+
+#include <ready_trader_go/baseautotrader.h>
+#include <ready_trader_go/types.h>
+
+#include "autotrader.h"
+#include "journal.h"
+#include "sendsink.h"
+
+// Hands one inbound journal record to any strategy's library handlers. Timer
+// and outbound records are not messages and are skipped.
+inline void feedRecord(ReadyTraderGo::BaseAutoTrader& trader, const JournalRecord& record)
+{
+    using namespace ReadyTraderGo;
+
+    switch (record.type) {
+    case JournalType::ORDER_BOOK:
+    case JournalType::TRADE_TICKS: {
+        std::array<std::array<unsigned long, TOP_LEVEL_COUNT>, 4> levels;
+        for (int side = 0; side < 4; side++) {
+            for (int i = 0; i < TOP_LEVEL_COUNT; i++) levels[side][i] = record.book.levels[side][i];
+        }
+        Instrument instrument = static_cast<Instrument>(record.instrument);
+        if (record.type == JournalType::ORDER_BOOK) {
+            trader.OrderBookMessageHandler(instrument, record.book.sequenceNumber,
+                                           levels[0], levels[1], levels[2], levels[3]);
+        }
+        else {
+            trader.TradeTicksMessageHandler(instrument, record.book.sequenceNumber,
+                                            levels[0], levels[1], levels[2], levels[3]);
+        }
+        break;
+    }
+    case JournalType::ORDER_FILLED:
+        trader.OrderFilledMessageHandler(record.fill.clientOrderId, record.fill.price, record.fill.volume);
+        break;
+    case JournalType::HEDGE_FILLED:
+        trader.HedgeFilledMessageHandler(record.fill.clientOrderId, record.fill.price, record.fill.volume);
+        break;
+    case JournalType::ORDER_STATUS:
+        trader.OrderStatusMessageHandler(record.status.clientOrderId, record.status.fillVolume,
+                                         record.status.remainingVolume, record.status.fees);
+        break;
+    case JournalType::ERROR: {
+        // Reused like the library's own message buffer, so feeding errors does not allocate
+        static thread_local std::string message(sizeof(record.error.message), '\0');
+        message.assign(record.error.message, record.length);
+        trader.ErrorMessageHandler(record.error.clientOrderId, message);
+        break;
+    }
+    case JournalType::DISCONNECT:
+        trader.DisconnectHandler();
+        break;
+    default:
+        break;
+    }
+}
+
+inline bool isInbound(JournalType type)
+{
+    return type != JournalType::NONE && type < JournalType::INSERT_ORDER;
+}
+
+// Owns a trader driven from journal records, AutoTrader or any other
+// StrategyTrader composition instantiated in autotrader.cc. It is built on a
+// context that never runs, so its own timers and warm-up never fire: timer
+// expiries come from TIMER records, or from FireDueTimer when the caller is
+// making up its own event stream. A hedge wait is parked up front, so the trader never
+// starts another one (see waitForHedgeDeadline) and replays do not allocate.
+// The trader journals into memory with the original run's calibration and is
+// stamped with each record's ticks, so its clock reads exactly what the
+// original run's did.
+template<typename TraderType = AutoTrader>
+class ReplayDriver
+{
+public:
+    ReplayDriver(boost::asio::io_context& context, const JournalHeader& original, SendSink* sendSink = nullptr)
+        : mTrader(std::make_unique<TraderType>(context, sendSink ? sendSink : &mNullSink))
+    {
+        mTrader->mJournal.OpenReplay(original);
+        mTrader->mHedgeDeadline = std::chrono::steady_clock::time_point::max();
+        mTrader->waitForHedgeDeadline();
+    }
+
+    void Feed(const JournalRecord& record)
+    {
+        mTrader->mJournal.ReplayTicks(record.timestamp);
+        if (record.type == JournalType::TIMER) mTrader->hedgeTimerExpired();
+        else feedRecord(*mTrader, record);
+    }
+
+    // Fires the hedge deadline if it is armed and due at the given ticks
+    void FireDueTimer(std::uint64_t ticks)
+    {
+        TraderType& trader = *mTrader;
+        if (!trader.mHedgeTimerArmed) return;
+
+        trader.mJournal.ReplayTicks(ticks);
+        auto nanoseconds = std::chrono::nanoseconds(journalNanoseconds(trader.mJournal.Header(), ticks));
+        if (std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(nanoseconds))
+            >= trader.mHedgeDeadline) {
+            trader.hedgeTimerExpired();
+        }
+    }
+
+    TraderType& Trader() { return *mTrader; }
+    bool Killed() const { return mTrader->mKilled; }
+
+    // Everything the replayed trader received and sent
+    const Journal& Output() const { return mTrader->mJournal; }
+
+private:
+    NullSendSink mNullSink;
+    std::unique_ptr<TraderType> mTrader;
+};
+
+#endif //CPPREADY_TRADER_GO_REPLAYDRIVER_H
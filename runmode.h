@@ -0,0 +1,142 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_RUNMODE_H
+#define CPPREADY_TRADER_GO_RUNMODE_H
+
+#include <chrono>
+#include <functional>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <ready_trader_go/logging.h>
+
+#include "latency.h"
+
+RTG_INLINE_GLOBAL_LOGGER_WITH_CHANNEL(LG_RUN, "RUN")
+
+// How host.cc runs each thread's io_context, from the optional "RunMode"
+// section of host.json:
+//
+//   "RunMode": {"BusyPoll": true, "Core": 3, "Fifo": false}
+//
+// The default is the plain blocking io_context::run().
+struct RunMode
+{
+    bool busyPoll = false;
+    int core = -1;
+    bool fifo = false;
+    int fifoPriority = 1;
+};
+
+inline RunMode LoadRunMode(const boost::property_tree::ptree& config)
+{
+    RunMode mode;
+    mode.busyPoll = config.get<bool>("RunMode.BusyPoll", mode.busyPoll);
+    mode.core = config.get<int>("RunMode.Core", mode.core);
+    mode.fifo = config.get<bool>("RunMode.Fifo", mode.fifo);
+    mode.fifoPriority = config.get<int>("RunMode.FifoPriority", mode.fifoPriority);
+    return mode;
+}
+
+// Measures how late a busy-polled io_context runs a timer handler after its
+// expiry: the rest of the current spin of the poll loop, including the handlers
+// and poller ahead of it. This is timer lateness, not wake-up latency from a
+// socket, and it only means something while nothing sleeps in the kernel.
+class TimerLatenessProbe
+{
+public:
+    static constexpr std::chrono::milliseconds INTERVAL{10};
+
+    TimerLatenessProbe(boost::asio::io_context& context, std::function<bool()> finished)
+        : mTimer(context), mFinished(std::move(finished))
+    {
+        arm();
+    }
+
+    const LatencyHistogram& Histogram() const { return mHistogram; }
+
+private:
+    void arm()
+    {
+        mTimer.expires_after(INTERVAL);
+        mTimer.async_wait([this](const boost::system::error_code& error) {
+            if (error) return;
+            auto late = std::chrono::steady_clock::now() - mTimer.expiry();
+            mHistogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(late).count());
+            // Stop re-arming once the trader is done so that the context can run out of work
+            if (!mFinished()) arm();
+        });
+    }
+
+    boost::asio::steady_timer mTimer;
+    std::function<bool()> mFinished;
+    LatencyHistogram mHistogram;
+};
+
+// Runs the context until it runs out of work, in place of context.run().
+// Busy polling never sleeps in the kernel, so it should be paired with a
+// dedicated core; SCHED_FIFO needs CAP_SYS_NICE and is skipped with a warning
+// if the system refuses it. finished should report when the trader is done.
+// An external poller, such as BroadcastReader::Poll, is called on every spin
+// of the loop and forces busy polling since nothing would wake the context for it.
+inline void RunContext(boost::asio::io_context& context, const RunMode& mode, std::function<bool()> finished,
+                       std::function<int()> poller = {})
+{
+    bool busyPoll = mode.busyPoll || poller;
+
+    if (mode.core >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(mode.core, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            RLOG(LG_RUN, ReadyTraderGo::LogLevel::LL_WARNING) << "could not pin to core " << mode.core;
+        }
+    }
+    if (mode.fifo) {
+        sched_param param{};
+        param.sched_priority = mode.fifoPriority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            RLOG(LG_RUN, ReadyTraderGo::LogLevel::LL_WARNING) << "could not switch to SCHED_FIFO";
+        }
+    }
+
+    if (!busyPoll) {
+        context.run();
+        return;
+    }
+
+    // poll() stops the context once there is no work left
+    TimerLatenessProbe probe(context, std::move(finished));
+    while (!context.stopped()) {
+        context.poll();
+        if (poller) poller();
+    }
+
+    const LatencyHistogram& histogram = probe.Histogram();
+    RLOG(LG_RUN, ReadyTraderGo::LogLevel::LL_INFO) << "timer lateness (busy poll) samples: " << histogram.Count()
+                                                   << " p50: " << histogram.Percentile(0.5) << "ns"
+                                                   << " p99: " << histogram.Percentile(0.99) << "ns"
+                                                   << " max: " << histogram.Max() << "ns";
+}
+
+#endif //CPPREADY_TRADER_GO_RUNMODE_H
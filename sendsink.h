@@ -0,0 +1,47 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_SENDSINK_H
+#define CPPREADY_TRADER_GO_SENDSINK_H
+
+#include <ready_trader_go/types.h>
+
+// Where a strategy's outbound messages go when it is not talking to the
+// exchange: warm-up, replay and the A/B harness attach one in place of the
+// execution connection.
+class SendSink
+{
+public:
+    virtual ~SendSink() = default;
+
+    virtual void InsertOrder(unsigned long clientOrderId, ReadyTraderGo::Side side, unsigned long price,
+                             unsigned long volume, ReadyTraderGo::Lifespan lifespan) = 0;
+    virtual void CancelOrder(unsigned long clientOrderId) = 0;
+    virtual void HedgeOrder(unsigned long clientOrderId, ReadyTraderGo::Side side, unsigned long price,
+                            unsigned long volume) = 0;
+};
+
+// Drops everything
+class NullSendSink : public SendSink
+{
+public:
+    void InsertOrder(unsigned long, ReadyTraderGo::Side, unsigned long, unsigned long, ReadyTraderGo::Lifespan) override {}
+    void CancelOrder(unsigned long) override {}
+    void HedgeOrder(unsigned long, ReadyTraderGo::Side, unsigned long, unsigned long) override {}
+};
+
+#endif //CPPREADY_TRADER_GO_SENDSINK_H
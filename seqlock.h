@@ -0,0 +1,60 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_SEQLOCK_H
+#define CPPREADY_TRADER_GO_SEQLOCK_H
+
+#include <atomic>
+#include <type_traits>
+
+// Single writer, many reader sequence lock for a small trivially copyable value.
+// The writer never waits. Readers copy the value and retry if the sequence was
+// odd (write in progress) or changed while they were copying.
+template<typename T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock values are copied while being written");
+
+public:
+    void Store(const T& value)
+    {
+        unsigned long sequence = mSequence.load(std::memory_order_relaxed);
+        mSequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        mValue = value;
+        mSequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    T Load() const
+    {
+        T value;
+        unsigned long before, after;
+        do {
+            before = mSequence.load(std::memory_order_acquire);
+            value = mValue;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = mSequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return value;
+    }
+
+private:
+    alignas(64) std::atomic<unsigned long> mSequence{0};
+    T mValue = {};
+};
+
+#endif //CPPREADY_TRADER_GO_SEQLOCK_H
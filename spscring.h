@@ -0,0 +1,69 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_SPSCRING_H
+#define CPPREADY_TRADER_GO_SPSCRING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free ring for exactly one producer thread and one consumer thread.
+// Head and tail live on their own cache lines, and each side keeps a cached copy
+// of the other side's index so that it only touches the shared line when the
+// ring looks full (producer) or empty (consumer).
+template<typename T, std::size_t N>
+class SpscRing
+{
+    static_assert(N && (N & (N - 1)) == 0, "ring size must be a power of two");
+
+public:
+    // Producer side, returns false without blocking if the ring is full
+    bool TryPush(const T& value)
+    {
+        std::size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mCachedHead == N) {
+            mCachedHead = mHead.load(std::memory_order_acquire);
+            if (tail - mCachedHead == N) return false;
+        }
+        mSlots[tail & (N - 1)] = value;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns false without blocking if the ring is empty
+    bool TryPop(T& value)
+    {
+        std::size_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mCachedTail) {
+            mCachedTail = mTail.load(std::memory_order_acquire);
+            if (head == mCachedTail) return false;
+        }
+        value = mSlots[head & (N - 1)];
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<std::size_t> mTail{0};
+    std::size_t mCachedHead = 0;
+    alignas(64) std::atomic<std::size_t> mHead{0};
+    std::size_t mCachedTail = 0;
+    alignas(64) std::array<T, N> mSlots = {};
+};
+
+#endif //CPPREADY_TRADER_GO_SPSCRING_H
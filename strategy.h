@@ -0,0 +1,243 @@
+// Copyright 2021 Optiver Asia Pacific Pty. Ltd.
+//
+// This file is part of Ready Trader Go.
+//
+//     Ready Trader Go is free software: you can redistribute it and/or
+//     modify it under the terms of the GNU Affero General Public License
+//     as published by the Free Software Foundation, either version 3 of
+//     the License, or (at your option) any later version.
+//
+//     Ready Trader Go is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Affero General Public License for more details.
+//
+//     You should have received a copy of the GNU Affero General Public
+//     License along with Ready Trader Go.  If not, see
+//     <https://www.gnu.org/licenses/>.
+#ifndef CPPREADY_TRADER_GO_STRATEGY_H
+#define CPPREADY_TRADER_GO_STRATEGY_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+#include <ready_trader_go/types.h>
+
+#include "analytics.h"
+
+// Strategy decisions as compile-time policies. A strategy is a StrategyCore
+// composed of one policy of each kind:
+//
+//   Pricing - where to quote each side against the futures touch, and when not to
+//   Sizing  - how many lots to quote each side
+//   Hedging - how much exposure to carry, and at what price to hedge the rest
+//   Risk    - position and volume room, and the drawdown the kill switch allows
+//
+// StrategyTrader (autotrader.h) does everything else, the same for every
+// strategy, and calls into its core at each decision. Policies are plain
+// policy classes, templated on the composed core only so that one can read
+// another's tuning through it, e.g. sizing against Core::POSITION_LIMIT from
+// the risk policy; none casts to the core or calls into it. Everything is
+// resolved at compile time; a new variant is a new composition, not a copy of
+// the trader. Tuning constants are static constexpr members so that they fold
+// exactly like the file scope constants they replaced.
+
+constexpr int TICK_SIZE_IN_CENTS = 100;
+constexpr int MIN_BID_NEARST_TICK = (ReadyTraderGo::MINIMUM_BID + TICK_SIZE_IN_CENTS) / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
+constexpr int MAX_ASK_NEAREST_TICK = ReadyTraderGo::MAXIMUM_ASK / TICK_SIZE_IN_CENTS * TICK_SIZE_IN_CENTS;
+
+// Quote toxicity throttle state for one side
+enum class Throttle
+{
+    NONE,
+    WIDEN,
+    PULL
+};
+
+template<template<typename> class Pricing,
+         template<typename> class Sizing,
+         template<typename> class Hedging,
+         template<typename> class Risk>
+class StrategyCore : public Pricing<StrategyCore<Pricing, Sizing, Hedging, Risk>>,
+                     public Sizing<StrategyCore<Pricing, Sizing, Hedging, Risk>>,
+                     public Hedging<StrategyCore<Pricing, Sizing, Hedging, Risk>>,
+                     public Risk<StrategyCore<Pricing, Sizing, Hedging, Risk>>
+{
+};
+
+// Quotes at the futures touch plus FUT_CLEARANCE. Per side: widen when recent
+// markouts on that side are bad or aggressive flow is running one way into our
+// quote, pull the quote when both are true. Asks are hit by aggressive buyers,
+// so buying flow counts against asks and selling flow against bids.
+template<typename Core>
+class FuturesTouchPricing
+{
+public:
+    static constexpr int FUT_CLEARANCE = 0 * TICK_SIZE_IN_CENTS;
+    static constexpr double TOXIC_MARKOUT = -1.0 * TICK_SIZE_IN_CENTS;
+    static constexpr double TOXIC_FLOW = 0.6;
+    static constexpr unsigned long THROTTLE_WIDEN_TICKS = 1;
+
+    // Returns true if either side changed
+    bool UpdateThrottle(const AnalyticsSignals& signals)
+    {
+        bool askMarkoutBad = signals.recentSellMarkout < TOXIC_MARKOUT;
+        bool askFlowBad = signals.tradeFlow > TOXIC_FLOW;
+        Throttle ask = (askMarkoutBad && askFlowBad) ? Throttle::PULL
+                     : (askMarkoutBad || askFlowBad) ? Throttle::WIDEN : Throttle::NONE;
+
+        bool bidMarkoutBad = signals.recentBuyMarkout < TOXIC_MARKOUT;
+        bool bidFlowBad = signals.tradeFlow < -TOXIC_FLOW;
+        Throttle bid = (bidMarkoutBad && bidFlowBad) ? Throttle::PULL
+                     : (bidMarkoutBad || bidFlowBad) ? Throttle::WIDEN : Throttle::NONE;
+
+        bool changed = ask != mAskThrottle || bid != mBidThrottle;
+        mAskThrottle = ask;
+        mBidThrottle = bid;
+        return changed;
+    }
+
+    Throttle AskThrottle() const { return mAskThrottle; }
+    Throttle BidThrottle() const { return mBidThrottle; }
+
+    unsigned long AskPrice(unsigned long futBestAskPrice) const
+    {
+        unsigned long widen = (mAskThrottle == Throttle::WIDEN) ? THROTTLE_WIDEN_TICKS * TICK_SIZE_IN_CENTS : 0;
+        return futBestAskPrice + FUT_CLEARANCE + widen;
+    }
+
+    unsigned long BidPrice(unsigned long futBestBidPrice) const
+    {
+        unsigned long widen = (mBidThrottle == Throttle::WIDEN) ? THROTTLE_WIDEN_TICKS * TICK_SIZE_IN_CENTS : 0;
+        return futBestBidPrice - FUT_CLEARANCE - widen;
+    }
+
+private:
+    Throttle mAskThrottle = Throttle::NONE;
+    Throttle mBidThrottle = Throttle::NONE;
+};
+
+// A quote scales with the liquidity we could trade and hedge through (the
+// thinner of our side of the ETF book and the futures side we would hedge on)
+// and with recent trading intensity, but never beyond half the inventory room
+// left on that side.
+template<typename Core>
+class DepthSizing
+{
+public:
+    static constexpr unsigned long SIZE_MIN = 5;
+    static constexpr double SIZE_DEPTH_SHARE = 0.05;
+    static constexpr double SIZE_INTENSITY_SHARE = 0.5;
+
+    void UpdateSizes(unsigned long etfAskDepth, unsigned long etfBidDepth,
+                     unsigned long futAskDepth, unsigned long futBidDepth,
+                     const AnalyticsSignals& signals, long etfPosition)
+    {
+        // Selling ETF is hedged by buying futures and the other way round
+        double askTarget = SIZE_MIN + std::min(etfAskDepth, futAskDepth) * SIZE_DEPTH_SHARE + signals.tradeIntensity * SIZE_INTENSITY_SHARE;
+        double bidTarget = SIZE_MIN + std::min(etfBidDepth, futBidDepth) * SIZE_DEPTH_SHARE + signals.tradeIntensity * SIZE_INTENSITY_SHARE;
+
+        mAskSize = std::min((unsigned long)askTarget, (Core::POSITION_LIMIT + etfPosition) / 2);
+        mBidSize = std::min((unsigned long)bidTarget, (Core::POSITION_LIMIT - etfPosition) / 2);
+    }
+
+    unsigned long AskSize() const { return mAskSize; }
+    unsigned long BidSize() const { return mBidSize; }
+
+private:
+    unsigned long mAskSize = 0;
+    unsigned long mBidSize = 0;
+};
+
+// Quotes half the inventory room left on each side whatever the book looks
+// like, as in the mm-one-order-half-position-limits runs
+template<typename Core>
+class HalfRoomSizing
+{
+public:
+    void UpdateSizes(unsigned long, unsigned long, unsigned long, unsigned long, const AnalyticsSignals&,
+                     long etfPosition)
+    {
+        mAskSize = (Core::POSITION_LIMIT + etfPosition) / 2;
+        mBidSize = (Core::POSITION_LIMIT - etfPosition) / 2;
+    }
+
+    unsigned long AskSize() const { return mAskSize; }
+    unsigned long BidSize() const { return mBidSize; }
+
+private:
+    unsigned long mAskSize = 0;
+    unsigned long mBidSize = 0;
+};
+
+// Carries up to HEDGE_LIMIT lots of net exposure. HEDGE_NETTED_MARGIN before the
+// exchange's limit it hedges the rest, less what our resting ETF quotes on the
+// reducing side would offset; HEDGE_SAFETY_MARGIN before it, if those quotes did
+// not fill, it hedges whatever is left without counting them. Hedges are priced
+// at the worst futures level needed to cover the volume plus at most
+// HEDGE_SLIPPAGE_TICKS; the residual is retried up to HEDGE_MAX_RETRIES times.
+template<typename Core>
+class DeadlineHedging
+{
+public:
+    static constexpr int HEDGE_LIMIT = 10;
+    static constexpr int HEDGE_SLIPPAGE_TICKS = 2;
+    static constexpr int HEDGE_MAX_RETRIES = 3;
+    static constexpr std::chrono::milliseconds HEDGE_NETTED_MARGIN{8000};
+    static constexpr std::chrono::milliseconds HEDGE_SAFETY_MARGIN{5000};
+
+    // Without any futures book we have nothing to price from, so fall back to
+    // the exchange bounds
+    unsigned long HedgePrice(ReadyTraderGo::Side side, unsigned long volume,
+                             const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& prices,
+                             const std::array<unsigned long, ReadyTraderGo::TOP_LEVEL_COUNT>& volumes) const
+    {
+        if (!prices[0]) {
+            return (side == ReadyTraderGo::Side::BUY) ? MAX_ASK_NEAREST_TICK : MIN_BID_NEARST_TICK;
+        }
+
+        unsigned long covered = 0;
+        unsigned long price = prices[0];
+        for (int i = 0; i < ReadyTraderGo::TOP_LEVEL_COUNT && prices[i] && covered < volume; i++) {
+            covered += volumes[i];
+            price = prices[i];
+        }
+
+        constexpr unsigned long slippage = HEDGE_SLIPPAGE_TICKS * TICK_SIZE_IN_CENTS;
+        if (side == ReadyTraderGo::Side::BUY) return std::min(price + slippage, (unsigned long)MAX_ASK_NEAREST_TICK);
+        return (price > MIN_BID_NEARST_TICK + slippage) ? price - slippage : MIN_BID_NEARST_TICK;
+    }
+};
+
+// Worst case for bids is every live bid filling on top of the current position,
+// likewise for asks, and total live volume stays within the active volume limit
+template<typename Core>
+class PositionRisk
+{
+public:
+    static constexpr unsigned long POSITION_LIMIT = 100;
+    static constexpr unsigned long ACTIVE_VOLUME_LIMIT = 200;
+    static constexpr signed long KILL_MAX_DRAWDOWN = 500000;
+
+    unsigned long ClipVolume(ReadyTraderGo::Side side, unsigned long volume, long etfPosition,
+                             unsigned long liveBidVolume, unsigned long liveAskVolume) const
+    {
+        long positionRoom = (side == ReadyTraderGo::Side::BUY)
+                            ? (long)POSITION_LIMIT - (etfPosition + (long)liveBidVolume)
+                            : (long)POSITION_LIMIT + (etfPosition - (long)liveAskVolume);
+        long activeRoom = (long)ACTIVE_VOLUME_LIMIT - (long)(liveBidVolume + liveAskVolume);
+        long room = std::min(positionRoom, activeRoom);
+
+        if (room <= 0) return 0;
+        return std::min(volume, (unsigned long)room);
+    }
+};
+
+// The strategy autotrader runs
+using DefaultStrategy = StrategyCore<FuturesTouchPricing, DepthSizing, DeadlineHedging, PositionRisk>;
+
+// DefaultStrategy with fixed half room quote sizes
+using HalfRoomStrategy = StrategyCore<FuturesTouchPricing, HalfRoomSizing, DeadlineHedging, PositionRisk>;
+
+#endif //CPPREADY_TRADER_GO_STRATEGY_H